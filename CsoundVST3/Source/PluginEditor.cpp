@@ -17,6 +17,7 @@ CsoundVST3AudioProcessorEditor::CsoundVST3AudioProcessorEditor (CsoundVST3AudioP
     addAndMakeVisible(saveButton);
     addAndMakeVisible(saveAsButton);
     addAndMakeVisible(playButton);
+    addAndMakeVisible(evaluateButton);
     addAndMakeVisible(stopButton);
     addAndMakeVisible(findButton);
     addAndMakeVisible(aboutButton);
@@ -26,6 +27,7 @@ CsoundVST3AudioProcessorEditor::CsoundVST3AudioProcessorEditor (CsoundVST3AudioP
     saveButton.addListener(this);
     saveAsButton.addListener(this);
     playButton.addListener(this);
+    evaluateButton.addListener(this);
     stopButton.addListener(this);
     findButton.addListener(this);
     aboutButton.addListener(this);
@@ -34,6 +36,10 @@ CsoundVST3AudioProcessorEditor::CsoundVST3AudioProcessorEditor (CsoundVST3AudioP
     statusBar.setText("Ready", juce::dontSendNotification);
     statusBar.setJustificationType(juce::Justification::left);
     addAndMakeVisible(statusBar);
+    latencyStatus.setJustificationType(juce::Justification::right);
+    addAndMakeVisible(latencyStatus);
+    outputStatus.setJustificationType(juce::Justification::right);
+    addAndMakeVisible(outputStatus);
 
     // Code Editor
     csd_code_tokeniser = std::make_unique<CsoundTokeniser>();
@@ -92,6 +98,8 @@ void CsoundVST3AudioProcessorEditor::resized()
     saveAsButton.setTooltip("Save edited .csd to a .csd file");
     playButton.setBounds(menuBar.removeFromLeft(80));
     playButton.setTooltip("Stop Csound, compile the .csd, and start the performance");
+    evaluateButton.setBounds(menuBar.removeFromLeft(80));
+    evaluateButton.setTooltip("Compile the selection, or else the changed instruments, into the running Csound");
     stopButton.setBounds(menuBar.removeFromLeft(80));
     stopButton.setTooltip("Stop the Csound performance");
     findButton.setBounds(menuBar.removeFromLeft(80));
@@ -101,7 +109,10 @@ void CsoundVST3AudioProcessorEditor::resized()
 
     // Status Bar
     auto statusBarHeight = 20;
-    statusBar.setBounds(bounds.removeFromBottom(statusBarHeight));
+    auto statusBarBounds = bounds.removeFromBottom(statusBarHeight);
+    latencyStatus.setBounds(statusBarBounds.removeFromRight(320));
+    outputStatus.setBounds(statusBarBounds.removeFromRight(statusBarBounds.getWidth() / 2));
+    statusBar.setBounds(statusBarBounds);
 
     juce::Component *components[] = {codeEditor.get(), &divider, messageLog.get()};
     verticalLayout.layOutComponents(components, 3, bounds.getX(), bounds.getY(), bounds.getWidth(), bounds.getHeight(), true, true) ;
@@ -177,6 +188,12 @@ void CsoundVST3AudioProcessorEditor::buttonClicked(juce::Button* button)
         audioProcessor.csoundMessage("Playing...\n");
         audioProcessor.csoundIsPlaying = true;
     }
+    else if (button == &evaluateButton)
+    {
+        statusBar.setText("Evaluate...", juce::dontSendNotification);
+        const auto selection = codeEditor->getHighlightedRegion();
+        audioProcessor.requestEvaluation(codeEditor->getDocument().getAllContent(), selection.isEmpty() ? juce::String() : codeEditor->getTextInRange(selection));
+    }
     else if (button == &stopButton)
     {
         statusBar.setText("Stop...", juce::dontSendNotification);
@@ -203,9 +220,12 @@ void CsoundVST3AudioProcessorEditor::changeListenerCallback(juce::ChangeBroadcas
 
 void CsoundVST3AudioProcessorEditor::timerCallback()
 {
-    while (auto message = audioProcessor.csound_messages_fifo.peek())
+    audioProcessor.csound_messages.read(messages);
+    if (messages.empty() == false)
     {
-        messageLog->insertTextAtCaret(*message);
-        audioProcessor.csound_messages_fifo.pop();
+        messageLog->insertTextAtCaret(juce::String::fromUTF8(messages.data(), int(messages.size())));
+        messages.clear();
     }
+    latencyStatus.setText(audioProcessor.getLatencyStatus(), juce::dontSendNotification);
+    outputStatus.setText(audioProcessor.getOutputStatus(), juce::dontSendNotification);
 }
@@ -131,16 +131,21 @@ public juce::Timer
     CsoundVST3AudioProcessor& audioProcessor;
     juce::CodeDocument csd_document;
     juce::CodeDocument messages_document;
+    // Csound messages read from the processor, reused by every timer tick.
+    std::string messages;
     
     juce::TextButton openButton{"Open..."};
     juce::TextButton saveButton{"Save"};
     juce::TextButton saveAsButton{"Save as..."};
     juce::TextButton playButton{"Play"};
+    juce::TextButton evaluateButton{"Evaluate"};
     juce::TextButton stopButton{"Stop"};
     juce::TextButton findButton{"Find..."};
     juce::TextButton aboutButton{"About"};
     
     juce::Label statusBar;
+    juce::Label latencyStatus;
+    juce::Label outputStatus;
     juce::StretchableLayoutManager verticalLayout;
     juce::StretchableLayoutResizerBar divider;
     
@@ -3,11 +3,27 @@
 #include "csoundvst3_version.h"
 #include <cassert>
 #include <csignal>
+#include <cmath>
 
 /**
  * Enable this to log behavior of FIFOs.
  */
 constexpr bool fifo_debug = false;
+// The most channels on any one bus, e.g. 16 for third-order ambisonics.
+constexpr int max_bus_channels = 64;
+// The number of auxiliary output buses after the main output bus.
+constexpr int aux_output_buses = 7;
+// The most MIDI events that one Csound block can take from the input FIFO.
+constexpr size_t midi_block_events_capacity = 4096;
+// The bytes of System Exclusive messages that each MIDI FIFO can hold.
+constexpr int midi_arena_bytes = 1 << 20;
+// The bytes of score statements for the notes of one Csound block, well
+// within the line buffer that Csound keeps for them, so that neither ever
+// has to grow.
+constexpr size_t note_events_bytes = 0x4000;
+// How often the message thread looks for work that other threads have
+// flagged for it.
+constexpr int message_thread_poll_hz = 30;
 
 /**
  * Permits a programmer to set a breakpoint in order to pause when
@@ -20,21 +36,86 @@ extern "C" void __tsan_on_report() {
 
 
 //==============================================================================
+/**
+ * The main buses, a side-chain input, and auxiliary output buses for stems.
+ * The side chain and the auxiliary outputs are disabled until the host
+ * enables them.
+ */
+static juce::AudioProcessor::BusesProperties getBusesProperties()
+{
+    auto buses_properties = juce::AudioProcessor::BusesProperties()
+        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+        .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)
+        .withOutput ("Output", juce::AudioChannelSet::stereo(), true);
+    for (int aux_bus = 1; aux_bus <= aux_output_buses; ++aux_bus)
+    {
+        buses_properties = buses_properties.withOutput("Aux " + juce::String(aux_bus), juce::AudioChannelSet::stereo(), false);
+    }
+    return buses_properties;
+}
+
 CsoundVST3AudioProcessor::CsoundVST3AudioProcessor()
-     : AudioProcessor (BusesProperties()
-                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
-                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
-                        ),
+     : AudioProcessor (getBusesProperties()),
+csound(std::make_unique<Csound>()),
 midi_input_fifo(65536),
-audio_input_fifo(65536),
 midi_output_fifo(65536),
-audio_output_fifo(65536),
-csound_messages_fifo(65536)
+reported_latency_frames(0),
+measured_latency_frames(0),
+render_ahead_blocks(0),
+hot_swap_crossfade_frames(0),
+compile_requested(false),
+evaluate_requested(false),
+live_csound(nullptr),
+crossfade_frames_done(0),
+retired_swaps(16),
+hot_swap_restart_pending(false),
+buffered_latency_pending(false),
+render_ahead_underruns(0),
+audio_input_overruns(0),
+transport_fifo(1024),
+transport_events_dropped(0),
+midi_events_dropped(0),
+sample_accurate_notes(false),
+note_events_size(0),
+note_events_dropped(0),
+midi_block_events_read(0),
+coalesce_controllers(false),
+midi_controllers_merged(0),
+mpe_instrument(0),
+mpe_bend_range(48),
+mpe_master_bend_range(2),
+midi_events_deferred(0),
+midi_output_sequence(0),
+midi_output_late(0),
+sample_kernels(&get_sample_kernels()),
+idle_after_frames(0),
+silent_frames(0),
+idle(false),
+idle_blocks(0),
+active_instances_channel(nullptr),
+tail_seconds(CsoundVST3Options::default_tail_seconds),
+offline_rendering(false),
+offline_ksmps_applied(false),
+realtime_restart_pending(false),
+csound_messages(4096)
 {
+    controller_binding_indexes.fill(-1);
+    controller_last_sequence.fill(-1);
+    controller_last_block.fill(-1);
+    mpe_pitch_bend_channels.fill(nullptr);
+    mpe_pressure_channels.fill(nullptr);
+    mpe_timbre_channels.fill(nullptr);
+    current_channel_table = std::make_unique<ChannelTable>();
+    parameter_bank.create(*this);
+    output_bank.create(*this);
+    startTimerHz(message_thread_poll_hz);
 }
 
 CsoundVST3AudioProcessor::~CsoundVST3AudioProcessor()
 {
+    stopTimer();
+    stopRenderAheadThread();
+    stopCompileThread();
 }
 
 //==============================================================================
@@ -63,7 +144,7 @@ bool CsoundVST3AudioProcessor::isMidiEffect() const
 
 double CsoundVST3AudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    return tail_seconds;
 }
 
 int CsoundVST3AudioProcessor::getNumPrograms()
@@ -94,10 +175,47 @@ void CsoundVST3AudioProcessor::changeProgramName (int index, const juce::String&
 
 void CsoundVST3AudioProcessor::csoundMessage(const juce::String message)
 {
-    csound_messages_fifo.enqueue(message);
+    csoundMessage(message.toRawUTF8());
+}
+
+/**
+ * Writes a message to the editor's message log, through the queue of the
+ * calling thread. Never allocates or locks, so it may be called on the
+ * audio thread, and from Csound's message callback on any thread.
+ */
+void CsoundVST3AudioProcessor::csoundMessage(const char *message)
+{
+    csound_messages.write(messageProducer(), message);
     DBG(message);
 }
 
+/**
+ * Returns which of csound_messages' queues the calling thread writes to.
+ * A thread that holds the MessageManagerLock counts as the message thread,
+ * since the message thread is then blocked.
+ */
+MessageQueues::Producer CsoundVST3AudioProcessor::messageProducer() const
+{
+    const auto thread_id = juce::Thread::getCurrentThreadId();
+    if (thread_id == compile_thread_id.load(std::memory_order_relaxed))
+    {
+        return MessageQueues::compile_thread;
+    }
+    if (thread_id == render_ahead_thread_id.load(std::memory_order_relaxed))
+    {
+        return MessageQueues::render_ahead_thread;
+    }
+    if (thread_id == audio_thread_id.load(std::memory_order_relaxed))
+    {
+        return MessageQueues::audio_thread;
+    }
+    if (juce::MessageManager::existsAndIsLockedByCurrentThread() == true)
+    {
+        return MessageQueues::message_thread;
+    }
+    return MessageQueues::other_thread;
+}
+
 void CsoundVST3AudioProcessor::csoundMessageCallback_(CSOUND *csound, int level, const char *format, va_list valist)
 {
     auto host_data = csoundGetHostData(csound);
@@ -114,20 +232,133 @@ void CsoundVST3AudioProcessor::releaseResources()
     stop();
 }
 
+/**
+ * Returns true for the channel sets that CsoundVST3 can map to Csound
+ * channels: any discrete layout, the usual surround layouts up to 7.1.4,
+ * and ambisonics up to third order. Csound itself only sees nchnls or
+ * nchnls_i channels, in the order of the host's layout.
+ */
+static bool isChannelSetSupported(const juce::AudioChannelSet &channel_set)
+{
+    if (channel_set.size() < 1 || channel_set.size() > max_bus_channels)
+    {
+        return false;
+    }
+    if (channel_set.isDiscreteLayout() == true)
+    {
+        return true;
+    }
+    auto ambisonic_order = channel_set.getAmbisonicOrder();
+    if (ambisonic_order >= 0)
+    {
+        return ambisonic_order <= 3;
+    }
+    static const juce::AudioChannelSet surround_sets[] =
+    {
+        juce::AudioChannelSet::mono(),
+        juce::AudioChannelSet::stereo(),
+        juce::AudioChannelSet::createLCR(),
+        juce::AudioChannelSet::quadraphonic(),
+        juce::AudioChannelSet::create5point0(),
+        juce::AudioChannelSet::create5point1(),
+        juce::AudioChannelSet::create7point0(),
+        juce::AudioChannelSet::create7point1(),
+        juce::AudioChannelSet::create5point1point4(),
+        juce::AudioChannelSet::create7point1point2(),
+        juce::AudioChannelSet::create7point0point4(),
+        juce::AudioChannelSet::create7point1point4(),
+    };
+    for (const auto &surround_set : surround_sets)
+    {
+        if (channel_set == surround_set)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool CsoundVST3AudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) const
 {
-    // Check output bus layout
-    const auto& mainOutput = layouts.getMainOutputChannelSet();
-    if (mainOutput != juce::AudioChannelSet::mono() &&
-        mainOutput != juce::AudioChannelSet::stereo())
-        return false; // Only mono or stereo output supported
-    // Check input bus layout
-    const auto& mainInput = layouts.getMainInputChannelSet();
-    if (mainInput.isDisabled() || // Allow no input
-        mainInput == juce::AudioChannelSet::mono() ||
-        mainInput == juce::AudioChannelSet::stereo())
-        return true; // Input can be mono, stereo, or none
-    return false; // Other configurations not supported
+    // The main output is required; the inputs and the auxiliary outputs
+    // may be disabled.
+    if (isChannelSetSupported(layouts.getMainOutputChannelSet()) == false)
+    {
+        return false;
+    }
+    for (int bus_index = 1; bus_index < layouts.outputBuses.size(); ++bus_index)
+    {
+        const auto &aux_output = layouts.outputBuses.getReference(bus_index);
+        if (aux_output.isDisabled() == false && isChannelSetSupported(aux_output) == false)
+        {
+            return false;
+        }
+    }
+    for (const auto &input : layouts.inputBuses)
+    {
+        if (input.isDisabled() == false && isChannelSetSupported(input) == false)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Hosts that can add and remove buses may have up to aux_output_buses
+ * auxiliary outputs.
+ */
+bool CsoundVST3AudioProcessor::canAddBus(bool is_input) const
+{
+    return is_input == false && getBusCount(false) < 1 + aux_output_buses;
+}
+
+bool CsoundVST3AudioProcessor::canRemoveBus(bool is_input) const
+{
+    return is_input == false && getBusCount(false) > 1;
+}
+
+/**
+ * Maps Csound's input and output channels to the channels of the host's
+ * buses, in bus order: Csound's first channels go to the first bus, and so
+ * on. A disabled bus keeps the Csound channels of its default layout, which
+ * then go nowhere, so that the Csound channels of later buses do not depend
+ * on which buses the host has enabled.
+ */
+void CsoundVST3AudioProcessor::buildChannelMaps()
+{
+    input_channel_map.resize(csound_input_channels, host_span_frames);
+    output_channel_map.resize(csound_output_channels, host_span_frames);
+    for (bool is_input : {true, false})
+    {
+        auto &channel_map = is_input ? input_channel_map : output_channel_map;
+        int csound_channel = 0;
+        for (int bus_index = 0; bus_index < getBusCount(is_input); ++bus_index)
+        {
+            auto bus = getBus(is_input, bus_index);
+            const bool enabled = bus->isEnabled();
+            const int channels = enabled ? bus->getNumberOfChannels() : bus->getDefaultLayout().size();
+            const int host_channel = enabled ? getChannelIndexInProcessBlockBuffer(is_input, bus_index, 0) : -1;
+            if (channels > 0 && csound_channel < channel_map.size())
+            {
+                csoundMessage(juce::String::formatted("%-24s%3d-%-3d -> %s %s\n",
+                                                      is_input ? "Csound input channels:" : "Csound output channels:",
+                                                      csound_channel + 1,
+                                                      std::min(csound_channel + channels, channel_map.size()),
+                                                      bus->getName().toRawUTF8(),
+                                                      enabled ? bus->getCurrentLayout().getDescription().toRawUTF8() : "(disabled)"));
+            }
+            csound_channel = channel_map.setRange(csound_channel, host_channel, channels);
+        }
+    }
+    unmapped_output_channels.clear();
+    for (int channel = 0; channel < std::max(getTotalNumInputChannels(), getTotalNumOutputChannels()); ++channel)
+    {
+        if (output_channel_map.isMapped(channel) == false)
+        {
+            unmapped_output_channels.push_back(channel);
+        }
+    }
 }
 
 int CsoundVST3AudioProcessor::midiDeviceOpen(CSOUND *csound_, void **user_data,
@@ -144,74 +375,475 @@ int CsoundVST3AudioProcessor::midiDeviceClose(CSOUND *csound_, void *user_data)
 }
 /**
  * Called by Csound at every kperiod to receive incoming MIDI messages from
- * the host. Only MIDI channel messages are handled. Timing precision is the
- * audio processing block size, so accurate timing requires ksmps of 128 or so.
- * Messages up to the end of the current Csound block are consumed, and later
- * message are left in the FIFO for the next Csound block.
+ * the host, including System Exclusive, whose bytes come from
+ * midi_input_arena, and system realtime messages. The messages are those
+ * that performKsmps has taken from midi_input_fifo for the current Csound
+ * block, so timing precision is ksmps, unless sample-accurate notes are
+ * enabled, in which case notes do not come through here at all.
+ *
+ * Only whole messages that fit in midi_buffer_size are copied. Csound calls
+ * again while this returns data; any messages that it does not ask for in
+ * this kperiod are carried over, in order, to the next one.
  */
 int CsoundVST3AudioProcessor::midiRead(CSOUND *csound_, void *userData, unsigned char *midi_buffer, int midi_buffer_size)
 {
     int bytes_read = 0;
     auto csound_host_data = csoundGetHostData(csound_);
     CsoundVST3AudioProcessor *processor = static_cast<CsoundVST3AudioProcessor *>(csound_host_data);
-    int messages = 0;
-    while (true)
+    // An instance that is fading out after a hot swap gets no more input.
+    if (csound_ != processor->csound->GetCsound())
+    {
+        return 0;
+    }
+    auto &block_events = processor->midi_block_events;
+    for ( ; processor->midi_block_events_read < block_events.size(); ++processor->midi_block_events_read)
+    {
+        const auto message = &block_events[processor->midi_block_events_read];
+        auto size = message->getLength();
+        auto data = message->getData();
+        if (bytes_read + size > midi_buffer_size)
+        {
+            // A message that can never fit is dropped, rather than
+            // blocking all later messages.
+            if (bytes_read == 0 && message->isLongMessage() == true)
+            {
+                processor->midi_input_arena.skip(size);
+                ++processor->midi_events_dropped;
+                continue;
+            }
+            break;
+        }
+        if (message->isLongMessage() == true)
+        {
+            bytes_read += processor->midi_input_arena.read(midi_buffer + bytes_read, size);
+            continue;
+        }
+#if defined(JUCE_DEBUG)
+        if (fifo_debug == true)
+        {
+            char buffer[0x200];
+            auto tyme = message->plugin_frame / float(processor->getSampleRate());
+            std::snprintf(buffer, sizeof(buffer),
+                          "Plugin midiRead   #%5lld: time:%9.4f cs begin  %8llu plugin%8llu msg%8llu cs%8llu cs end  %8llu  %s", message->sequence, tyme, processor->csound_block_begin, processor->plugin_frame, message->plugin_frame, message->plugin_frame % processor->csound_frames, processor->csound_block_end, juce::MidiMessage(data, size).getDescription().toRawUTF8());
+            DBG(buffer);
+        }
+#endif
+        for (int i = 0; i < size; ++i, ++bytes_read)
+        {
+            midi_buffer[bytes_read] = data[i];
+        }
+    }
+    return bytes_read;
+}
+
+/**
+ * Takes the MIDI events for the Csound block about to be performed from
+ * midi_input_fifo, for midiRead. Events that midiRead has not yet
+ * delivered are kept, ahead of the new ones. MPE notes and expression go
+ * to Csound as score events and control channels. Control changes bound to
+ * control channels are written to those channels instead. If
+ * sample_accurate_notes is set, note on and note off messages are instead
+ * sent to Csound as score events, starting at their exact frame in the
+ * block.
+ */
+void CsoundVST3AudioProcessor::takeMidiEvents()
+{
+    midi_block_events.erase(midi_block_events.begin(), midi_block_events.begin() + ptrdiff_t(midi_block_events_read));
+    midi_block_events_read = 0;
+    midi_events_deferred += int64_t(midi_block_events.size());
+    while (auto midi_event = midi_input_fifo.peek())
     {
-        auto message = processor->midi_input_fifo.peek();
-        if (message == nullptr)
+        if (midi_event->plugin_frame >= csound_block_end)
         {
             break;
         }
-        // Skipping later messages.
-        if (message->plugin_frame >= processor->csound_block_end)
+        // The rest wait in the FIFO for the next block.
+        if (midi_block_events.size() == midi_block_events.capacity())
         {
+            ++midi_events_deferred;
             break;
         }
-        messages++;
-        char buffer[0x200];
-        auto size = message->message.getRawDataSize();
-        auto data = message->message.getRawData();
-        auto status = data[0];
-        // We process only MIDI channel messages.
-        if ((0x80 <= status) && (status <= 0xE0))
+        const bool handled = handleMpe(*midi_event) || writeBoundController(*midi_event) || (sample_accurate_notes == true && scheduleNote(*midi_event));
+        if (handled == false)
         {
-#if defined(JUCE_DEBUG)
-            if (fifo_debug == true)
+            midi_block_events.push_back(*midi_event);
+        }
+        midi_input_fifo.pop();
+    }
+}
+
+/**
+ * Looks up a Csound control channel for each controller mapping in the
+ * options, and indexes the bindings by MIDI channel and controller. Later
+ * mappings of the same controller replace earlier ones.
+ */
+void CsoundVST3AudioProcessor::bindControllers(const CsoundVST3Options &options, Csound &instance, const ChannelTable &table, std::vector<ControllerBinding> &bindings, std::array<int16_t, 16 * 128> &binding_indexes)
+{
+    bindings.clear();
+    binding_indexes.fill(-1);
+    for (const auto &mapping : options.controller_mappings)
+    {
+        ControllerBinding binding;
+        binding.channel_pointer = table.getChannelPtr(instance.GetCsound(), mapping.name, CSOUND_CONTROL_CHANNEL | CSOUND_INPUT_CHANNEL);
+        if (binding.channel_pointer == nullptr)
+        {
+            csoundMessage(juce::String::formatted("Could not bind controller %d to channel \"%s\".\n", mapping.controller, mapping.name.toRawUTF8()));
+            continue;
+        }
+        binding.minimum = MYFLT(mapping.minimum);
+        binding.range = MYFLT(mapping.maximum - mapping.minimum);
+        const auto index = int16_t(bindings.size());
+        bindings.push_back(binding);
+        for (int channel = 1; channel <= 16; ++channel)
+        {
+            if (mapping.channel == 0 || mapping.channel == channel)
             {
-                ///assert(message.plugin_frame >= processor->csound_block_begin && message.plugin_frame < processor->csound_block_end);
-                auto tyme = message->plugin_frame / float(processor->getSampleRate());
-                std::snprintf(buffer, sizeof(buffer),
-                              "Plugin midiRead   #%5lld: time:%9.4f cs begin  %8llu plugin%8llu msg%8llu cs%8llu cs end  %8llu  %s", message->sequence, tyme, processor->csound_block_begin, processor->plugin_frame, message->plugin_frame, message->csound_frame, processor->csound_block_end, message->message.getDescription().toRawUTF8());
-                DBG(buffer);
+                binding_indexes[size_t((channel - 1) * 128 + mapping.controller)] = index;
             }
-#endif
-            for (int i = 0; i < size; ++i, ++bytes_read)
+        }
+        csoundMessage(juce::String::formatted("Controller binding:     channel %2d controller %3d -> \"%s\" [%g, %g]\n", mapping.channel, mapping.controller, mapping.name.toRawUTF8(), mapping.minimum, mapping.maximum));
+    }
+}
+
+/**
+ * Marks the control changes in the host's MIDI buffer that are superseded
+ * by a newer control change for the same controller, on the same channel,
+ * in the same Csound block. Csound acts only on the newest value in a block
+ * anyway, so dense automation then costs one FIFO slot and one midiRead
+ * message per controller per block, rather than dozens.
+ *
+ * Bank select, data entry and (N)RPN controllers are never merged, since
+ * their order relative to other messages matters, nor are channel mode
+ * messages. Events that are not merged keep their own frames and order.
+ */
+void CsoundVST3AudioProcessor::markSupersededControllers(const juce::MidiBuffer &host_midi_buffer)
+{
+    const int events = std::min(host_midi_buffer.getNumEvents(), int(midi_superseded.size()));
+    std::fill_n(midi_superseded.begin(), events, uint8_t(0));
+    const int64_t first_sequence = midi_input_sequence;
+    int event_index = 0;
+    for (const auto metadata : host_midi_buffer)
+    {
+        if (event_index >= events)
+        {
+            break;
+        }
+        const auto data = metadata.data;
+        if (metadata.numBytes == 3 && (data[0] & 0xF0) == 0xB0)
+        {
+            const int controller = data[1];
+            const bool mergeable = controller != 0 && controller != 32 && controller != 6 && controller != 38 && (controller < 96 || controller > 101) && controller < 120;
+            if (mergeable == true)
             {
-                midi_buffer[bytes_read] = data[i];
+                const auto index = size_t(((data[0] & 0x0F) << 7) | controller);
+                const int64_t sequence = first_sequence + event_index;
+                const int64_t block = (host_block_begin + metadata.samplePosition - csound_block_origin) / csound_frames;
+                const int64_t previous_index = controller_last_sequence[index] - first_sequence;
+                if (previous_index >= 0 && controller_last_block[index] == block)
+                {
+                    midi_superseded[size_t(previous_index)] = 1;
+                }
+                controller_last_sequence[index] = sequence;
+                controller_last_block[index] = block;
             }
         }
-        else
+        ++event_index;
+    }
+}
+
+/**
+ * Sets up MPE from the options, with the zones reset. The expression
+ * channels are found by compileInstance.
+ */
+void CsoundVST3AudioProcessor::bindMpeChannels(const CsoundVST3Options &options)
+{
+    mpe_zones.reset();
+    mpe_instrument = options.mpe_instrument;
+    mpe_bend_range = MYFLT(options.mpe_bend_range);
+    mpe_master_bend_range = MYFLT(options.mpe_master_bend_range);
+    if (mpe_instrument > 0)
+    {
+        csoundMessage(juce::String::formatted("MPE instrument:         %3d\n", mpe_instrument));
+    }
+}
+
+/**
+ * If MPE is enabled, looks up the per-channel expression control channels
+ * in the Csound instance, named CsoundVST3_mpe_pitch_bend_n,
+ * CsoundVST3_mpe_pressure_n and CsoundVST3_mpe_timbre_n for MIDI channel
+ * n, so that expression is never routed by name during performance.
+ */
+void CsoundVST3AudioProcessor::findMpeChannels(const CsoundVST3Options &options, Csound &instance, const ChannelTable &table, std::array<MYFLT *, 17> &pitch_bend_channels, std::array<MYFLT *, 17> &pressure_channels, std::array<MYFLT *, 17> &timbre_channels)
+{
+    pitch_bend_channels.fill(nullptr);
+    pressure_channels.fill(nullptr);
+    timbre_channels.fill(nullptr);
+    if (options.mpe_instrument <= 0)
+    {
+        return;
+    }
+    const int channel_type = CSOUND_CONTROL_CHANNEL | CSOUND_INPUT_CHANNEL;
+    for (int channel = 1; channel <= 16; ++channel)
+    {
+        auto name = juce::String::formatted("CsoundVST3_mpe_pitch_bend_%d", channel);
+        pitch_bend_channels[size_t(channel)] = table.getChannelPtr(instance.GetCsound(), name, channel_type);
+        name = juce::String::formatted("CsoundVST3_mpe_pressure_%d", channel);
+        pressure_channels[size_t(channel)] = table.getChannelPtr(instance.GetCsound(), name, channel_type);
+        name = juce::String::formatted("CsoundVST3_mpe_timbre_%d", channel);
+        timbre_channels[size_t(channel)] = table.getChannelPtr(instance.GetCsound(), name, channel_type);
+    }
+}
+
+/**
+ * Handles MPE, if it is enabled, and returns true if the event is consumed.
+ *
+ * Notes on member channels play mpe_instrument as score events at their
+ * frames in the block, with p4 the key, p5 the velocity, and p6 the MIDI
+ * channel, whose expression control channels the instance should read.
+ * The fractional instrument number encodes the channel and key, so that
+ * the note off releases the same instance. Pitch bend, channel pressure
+ * and controller 74 (timbre) on member and master channels are written to
+ * the expression control channels; those on master channels, and all other
+ * messages, also go on to Csound's MIDI input. MPE Configuration Messages
+ * update the zones; RPNs are tracked on every channel, since an MCM may
+ * arrive on a channel that is not yet in a zone.
+ */
+bool CsoundVST3AudioProcessor::handleMpe(const MidiEvent &midi_event)
+{
+    if (mpe_instrument <= 0 || midi_event.isLongMessage() == true)
+    {
+        return false;
+    }
+    const auto data = midi_event.getData();
+    const auto type = data[0] & 0xF0;
+    const int channel = (data[0] & 0x0F) + 1;
+    if (type >= 0xF0)
+    {
+        return false;
+    }
+    if (type == 0xB0)
+    {
+        mpe_zones.handleControlChange(channel, data[1], data[2]);
+    }
+    const bool member = mpe_zones.isMemberChannel(channel);
+    if (member == false && mpe_zones.isMasterChannel(channel) == false)
+    {
+        return false;
+    }
+    switch (type)
+    {
+    case 0x80:
+    case 0x90:
+    {
+        if (member == false)
         {
-            DBG("Not a MIDI channel message!");
+            return false;
         }
-        processor->midi_input_fifo.pop();
+        const auto key = data[1];
+        const auto velocity = data[2];
+        const bool note_on = (type == 0x90 && velocity > 0);
+        const auto instrument = MYFLT(mpe_instrument) + MYFLT(channel) / MYFLT(100) + MYFLT(key) / MYFLT(100000);
+        queueNote(midi_event, instrument, note_on, key, velocity, channel);
+        return true;
     }
-    return bytes_read;
+    case 0xE0:
+    {
+        const auto bend = MYFLT((data[2] << 7) | data[1]) - MYFLT(8192);
+        if (auto pointer = mpe_pitch_bend_channels[size_t(channel)])
+        {
+            *pointer = bend / MYFLT(8192) * (member ? mpe_bend_range : mpe_master_bend_range);
+        }
+        return member;
+    }
+    case 0xD0:
+    {
+        if (auto pointer = mpe_pressure_channels[size_t(channel)])
+        {
+            *pointer = MYFLT(data[1]) / MYFLT(127);
+        }
+        return member;
+    }
+    case 0xB0:
+    {
+        if (data[1] == 74)
+        {
+            if (auto pointer = mpe_timbre_channels[size_t(channel)])
+            {
+                *pointer = MYFLT(data[2]) / MYFLT(127);
+            }
+            return member;
+        }
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+/**
+ * If the event is a control change bound to a Csound control channel,
+ * writes its scaled value straight to the channel, and returns true. This
+ * happens between kperiods, on the thread that runs Csound, so the value
+ * takes effect in the Csound block that contains the event.
+ */
+bool CsoundVST3AudioProcessor::writeBoundController(const MidiEvent &midi_event)
+{
+    if (controller_bindings.empty() == true || midi_event.getSize() != 3)
+    {
+        return false;
+    }
+    const auto data = midi_event.getData();
+    if ((data[0] & 0xF0) != 0xB0)
+    {
+        return false;
+    }
+    const auto index = controller_binding_indexes[size_t((data[0] & 0x0F) * 128 + (data[1] & 0x7F))];
+    if (index < 0)
+    {
+        return false;
+    }
+    const auto &binding = controller_bindings[size_t(index)];
+    *binding.channel_pointer = binding.minimum + binding.range * (MYFLT(data[2]) / MYFLT(127));
+    return true;
+}
+
+/**
+ * If the event is a note on or note off, sends it to Csound as a score event
+ * at its frame within the current Csound block, and returns true. MIDI
+ * channel n plays note_instruments[n], which is instrument n unless the
+ * options say otherwise; Csound's massign does not apply, since the notes
+ * never reach Csound's MIDI input. The instrument number carries the key
+ * as a fraction, so that the note off (an event with negative p1) releases
+ * the same instance. The key is p4, and the velocity is p5.
+ */
+bool CsoundVST3AudioProcessor::scheduleNote(const MidiEvent &midi_event)
+{
+    if (midi_event.getSize() != 3)
+    {
+        return false;
+    }
+    const auto data = midi_event.getData();
+    const auto type = data[0] & 0xF0;
+    if (type != 0x80 && type != 0x90)
+    {
+        return false;
+    }
+    const auto channel = (data[0] & 0x0F) + 1;
+    const auto key = data[1];
+    const auto velocity = data[2];
+    const bool note_on = (type == 0x90 && velocity > 0);
+    const auto instrument = MYFLT(note_instruments[size_t(channel)]) + MYFLT(key) / MYFLT(1000);
+    queueNote(midi_event, instrument, note_on, key, velocity, 0);
+    return true;
+}
+
+/**
+ * Appends to note_events an "i" statement for a note on, held until its
+ * note off (p3 is -1), or for a note off (negative p1), at the event's
+ * frame within the current Csound block. performKsmps sends the block's
+ * statements to Csound in one csoundInputMessage, rather than a
+ * csoundScoreEvent per note, which allocates. p1 is written with 17
+ * significant digits, so that a note off parses to exactly the same
+ * fractional instrument number as its note on. If mpe_channel is greater
+ * than 0, it is p6. A note that does not fit is dropped, and counted.
+ */
+void CsoundVST3AudioProcessor::queueNote(const MidiEvent &midi_event, MYFLT instrument, bool note_on, int key, int velocity, int mpe_channel)
+{
+    const auto offset_frames = std::max(midi_event.plugin_frame - csound_block_begin, int64_t(0));
+    const auto p1 = note_on ? instrument : -instrument;
+    const auto p2 = MYFLT(offset_frames) / csound->GetSr();
+    const int p3 = note_on ? -1 : 0;
+    auto line = note_events.data() + note_events_size;
+    const auto room = note_events.size() - note_events_size;
+    int size = 0;
+    if (mpe_channel > 0)
+    {
+        size = std::snprintf(line, room, "i %.17g %.17g %d %d %d %d\n", p1, p2, p3, key, velocity, mpe_channel);
+    }
+    else
+    {
+        size = std::snprintf(line, room, "i %.17g %.17g %d %d %d\n", p1, p2, p3, key, velocity);
+    }
+    if (size < 0 || size_t(size) >= room)
+    {
+        line[0] = '\0';
+        ++note_events_dropped;
+        return;
+    }
+    note_events_size += size_t(size);
+}
+
+/**
+ * Pushes a MIDI message onto a MIDI FIFO. A message too long for the
+ * MidiEvent itself, i.e. System Exclusive, has its bytes written to the
+ * FIFO's arena first. Never allocates; returns false, having pushed
+ * nothing, if the FIFO or the arena is full.
+ */
+static bool enqueueMidiEvent(moodycamel::ReaderWriterQueue<MidiEvent> &fifo, SysexArena &arena, MidiEvent &midi_event, const uint8_t *bytes, int size)
+{
+    if (bytes[0] != 0xF0 && midi_event.setShortMessage(bytes, size) == true)
+    {
+        return fifo.try_enqueue(midi_event);
+    }
+    // Only the producer adds to the FIFO, so if it has room now it will
+    // still have room after the bytes are written.
+    if (fifo.size_approx() >= fifo.max_capacity())
+    {
+        return false;
+    }
+    if (arena.write(bytes, size, midi_event.long_message_offset) == false)
+    {
+        return false;
+    }
+    midi_event.size = 0;
+    midi_event.long_message_size = uint32_t(size);
+    return fifo.try_enqueue(midi_event);
 }
 
 /**
- * Called by Csound for each output MIDI message, to send  MIDI data to the host.
+ * Called by Csound for output MIDI messages, to send MIDI data to the host.
+ * The buffer may hold more than one message. Returns the number of bytes
+ * consumed.
+ *
+ * Csound sends MIDI during the kperiod that produces it, so each message is
+ * stamped with the plugin frame at which the audio of that kperiod reaches
+ * the host, and processBlock then sends it to the host at exactly that
+ * offset in the host block that contains it. This never blocks: if
+ * midi_output_fifo is full, the message is dropped and counted.
  */
 int CsoundVST3AudioProcessor::midiWrite(CSOUND *csound_, void *userData, const unsigned char *midi_buffer, int midi_buffer_size)
 {
-    int result = 0;
     auto csound_host_data = csoundGetHostData(csound_);
     CsoundVST3AudioProcessor *processor = static_cast<CsoundVST3AudioProcessor *>(csound_host_data);
-    MidiChannelMessage channel_message;
-    channel_message.plugin_frame = processor->plugin_frame;
-    channel_message.message = juce::MidiMessage(midi_buffer, midi_buffer_size, 0);
-    processor->midi_output_fifo.enqueue(channel_message);
-    return result;
+    int bytes_written = 0;
+    while (bytes_written < midi_buffer_size)
+    {
+        const auto status = midi_buffer[bytes_written];
+        auto message_size = MidiEvent::getMessageSize(status);
+        if (status == 0xF0)
+        {
+            // System Exclusive runs through its 0xF7, or to the end of the
+            // buffer.
+            auto end = std::find(midi_buffer + bytes_written, midi_buffer + midi_buffer_size, 0xF7);
+            message_size = int(std::min(end + 1, midi_buffer + midi_buffer_size) - (midi_buffer + bytes_written));
+        }
+        if (message_size == 0 || bytes_written + message_size > midi_buffer_size)
+        {
+            // Not a MIDI message.
+            break;
+        }
+        MidiEvent midi_event;
+        // The output of this Csound block reaches the host after the input
+        // prefill, which is also the plugin's latency.
+        midi_event.plugin_frame = processor->csound_block_begin + processor->audio_input_prefill_frames;
+        midi_event.sequence = processor->midi_output_sequence++;
+        if (enqueueMidiEvent(processor->midi_output_fifo, processor->midi_output_arena, midi_event, midi_buffer + bytes_written, message_size) == false)
+        {
+            ++processor->midi_events_dropped;
+        }
+        bytes_written += message_size;
+    }
+    return bytes_written;
 }
 
 /**
@@ -220,6 +852,8 @@ int CsoundVST3AudioProcessor::midiWrite(CSOUND *csound_, void *userData, const u
  *
  * This function is called from processBlock before that function processes any
  * samples. Therefore, the times are always aligned with the start of the block.
+ * The new score time is sent through transport_fifo, and is applied to the
+ * Csound block that contains that frame.
  *
  * TODO: What if track has nonzero start -- is that possible?
  */
@@ -248,13 +882,32 @@ void CsoundVST3AudioProcessor::synchronizeScore(juce::Optional<juce::AudioPlayHe
         if (optional_host_frame_seconds.hasValue())
         {
             DBG("Looping...");
-            auto host_frame_seconds = *optional_host_frame_seconds;
-            csound.SetScoreOffsetSeconds(host_frame_seconds);
+            TransportEvent transport_event;
+            transport_event.plugin_frame = plugin_frame;
+            transport_event.score_offset_seconds = *optional_host_frame_seconds;
+            // Never allocate here; a full FIFO means the audio thread has
+            // stalled, and the loop is lost.
+            if (transport_fifo.try_enqueue(transport_event) == false)
+            {
+                ++transport_events_dropped;
+            }
         }
     }
     host_prior_frame = host_frame;
 }
 
+/**
+ * Compiled into the orchestra when idle mode is on. It is named, so it is
+ * numbered after, and performed after, every instrument in the csd.
+ */
+static const char *idle_monitor_orc = R"(
+instr CsoundVST3_idle_monitor
+k_active active 0
+chnset k_active - 1, "CsoundVST3_active_instances"
+endin
+schedule "CsoundVST3_idle_monitor", 0, -1
+)";
+
 template<typename T> void drain(moodycamel::ReaderWriterQueue<T> &queue)
 {
     T element;
@@ -264,39 +917,130 @@ template<typename T> void drain(moodycamel::ReaderWriterQueue<T> &queue)
     }
 }
 /**
- * Compiles the csd and starts Csound.
+ * Sets up a new or reset Csound instance to run inside the plugin: host
+ * data, messages, MIDI and audio I/O, the host's sample rate, and the
+ * Csound options that follow from CsoundVST3's own options.
  */
-void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+void CsoundVST3AudioProcessor::configureCsound(Csound &instance, const CsoundVST3Options &options)
 {
-    juce::MessageManagerLock lock;
-    drain(csound_messages_fifo);
-    auto editor = getActiveEditor();
-    if (editor)
-    {
-        auto pluginEditor = reinterpret_cast<CsoundVST3AudioProcessorEditor *>(editor);
-        pluginEditor->messageLog->loadContent("");
-
-    }
-    csoundMessage("CsoundVST3AudioProcessor::prepareToPlay...\n");
-    if (csoundIsPlaying == true)
+    // (Re-)set the Csound message callback.
+    instance.SetHostData(this);
+    instance.SetMessageCallback(csoundMessageCallback_);
+    // Set up connections with the host.
+    instance.SetHostImplementedMIDIIO(1);
+    instance.SetHostImplementedAudioIO(1, 0);
+    instance.SetExternalMidiInOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
+    instance.SetExternalMidiReadCallback(&CsoundVST3AudioProcessor::midiRead);
+    instance.SetExternalMidiInCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
+    instance.SetExternalMidiOutOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
+    instance.SetExternalMidiWriteCallback(&CsoundVST3AudioProcessor::midiWrite);
+    instance.SetExternalMidiOutCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
+    char buffer[0x200];
+    // Overrride the csd's sample rate.
+    int host_sample_rate = getSampleRate();
+    snprintf(buffer, sizeof(buffer), "--sample-rate=%d", host_sample_rate);
+    instance.SetOption(buffer);
+    // Prevents funny characters from being displaned in Csound messages.
+    snprintf(buffer, sizeof(buffer), "-+msg_color=0");
+    instance.SetOption(buffer);
+    // Notes, and MPE notes, become score events that start at their exact
+    // frames.
+    if (options.sample_accurate_notes == true || options.mpe_instrument > 0)
+    {
+        instance.SetOption("--sample-accurate");
+    }
+    // When bouncing, there is no deadline, so ksmps can be traded for
+    // quality.
+    if (isNonRealtime() == true && options.offline_ksmps > 0)
+    {
+        snprintf(buffer, sizeof(buffer), "--ksmps=%d", options.offline_ksmps);
+        instance.SetOption(buffer);
+    }
+}
+
+/**
+ * Compiles and starts the csd in a new Csound instance, and finds in it
+ * every channel that CsoundVST3 binds, except those of host parameters:
+ * the channel table, the idle monitor's channel, controller bindings, and
+ * MPE channels. Returns false if the csd does not compile and start.
+ * prepareToPlay exchanges the instance for the running one, and hot
+ * swapping swaps it in at a ksmps block boundary.
+ */
+bool CsoundVST3AudioProcessor::compileInstance(const juce::String &csd_, const CsoundVST3Options &options, HotSwap &instance)
+{
+    instance.csound = std::make_unique<Csound>();
+    configureCsound(*instance.csound, options);
+    // If there is a csd, compile it.
+    if (csd_.length() > 0)
+    {
+        auto csound_csd = CsoundVST3Options::strip(csd_);
+        if (instance.csound->CompileCsdText(csound_csd.toRawUTF8()) != 0)
+        {
+            csoundMessage("compileInstance: csound.CompileCsdText failed.\n");
+        }
+        if (instance.csound->Start() != 0)
+        {
+            csoundMessage("compileInstance: csound.Start failed.\n");
+        }
+    }
+    // The orchestra's own channels are listed before CsoundVST3 adds any.
+    instance.channel_table = ChannelTable::build(instance.csound->GetCsound());
+    // For idle mode, an always-on instrument publishes the number of other
+    // active instrument instances, i.e. all but itself.
+    instance.active_instances_channel = nullptr;
+    if (options.idle_after_seconds > 0 && instance.csound->GetSpout() != nullptr)
+    {
+        if (instance.csound->CompileOrc(idle_monitor_orc) == 0)
+        {
+            csoundGetChannelPtr(instance.csound->GetCsound(), &instance.active_instances_channel, "CsoundVST3_active_instances", CSOUND_CONTROL_CHANNEL | CSOUND_OUTPUT_CHANNEL);
+        }
+    }
+    bindControllers(options, *instance.csound, *instance.channel_table, instance.controller_bindings, instance.controller_binding_indexes);
+    findMpeChannels(options, *instance.csound, *instance.channel_table, instance.mpe_pitch_bend_channels, instance.mpe_pressure_channels, instance.mpe_timbre_channels);
+    return instance.csound->GetSpout() != nullptr;
+}
+
+/**
+ * Exchanges the running Csound instance, with all of its channel pointers
+ * other than those of host parameters, for another.
+ */
+void CsoundVST3AudioProcessor::exchangeInstance(HotSwap &instance)
+{
+    std::swap(csound, instance.csound);
+    std::swap(current_channel_table, instance.channel_table);
+    std::swap(controller_bindings, instance.controller_bindings);
+    std::swap(controller_binding_indexes, instance.controller_binding_indexes);
+    std::swap(mpe_pitch_bend_channels, instance.mpe_pitch_bend_channels);
+    std::swap(mpe_pressure_channels, instance.mpe_pressure_channels);
+    std::swap(mpe_timbre_channels, instance.mpe_timbre_channels);
+    std::swap(active_instances_channel, instance.active_instances_channel);
+}
+
+/**
+ * Compiles the csd and starts Csound.
+ */
+void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    juce::MessageManagerLock lock;
+    csound_messages.clear();
+    auto editor = getActiveEditor();
+    if (editor)
+    {
+        auto pluginEditor = reinterpret_cast<CsoundVST3AudioProcessorEditor *>(editor);
+        pluginEditor->messageLog->loadContent("");
+
+    }
+    csoundMessage("CsoundVST3AudioProcessor::prepareToPlay...\n");
+    stopRenderAheadThread();
+    stopCompileThread();
+    if (csoundIsPlaying == true)
     {
         csoundIsPlaying = false;
-        csound.Stop();
-        csound.Cleanup();
-        csound.Reset();
+        csound->Stop();
+        csound->Cleanup();
+        csound->Reset();
     }
-    // (Re-)set the Csound message callback.
-    csound.SetHostData(this);
-    csound.SetMessageCallback(csoundMessageCallback_);
-    // Set up connections with the host.
-    csound.SetHostImplementedMIDIIO(1);
-    csound.SetHostImplementedAudioIO(1, 0);
-    csound.SetExternalMidiInOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
-    csound.SetExternalMidiReadCallback(&CsoundVST3AudioProcessor::midiRead);
-    csound.SetExternalMidiInCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
-    csound.SetExternalMidiOutOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
-    csound.SetExternalMidiWriteCallback(&CsoundVST3AudioProcessor::midiWrite);
-    csound.SetExternalMidiOutCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
+    auto options = CsoundVST3Options::parse(csd);
     auto midi_input_devices = juce::MidiInput::getAvailableDevices();
     auto input_device_count = midi_input_devices.size();
     for (auto device_index = 0; device_index < input_device_count; ++device_index)
@@ -315,8 +1059,6 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
         message = message + "\n";
         csoundMessage(message);
     }
-    auto initial_delay_frames = csound.GetKsmps();
-    setLatencySamples(initial_delay_frames);
     /*
      Message level for standard (terminal) output. Takes the sum of any of the following values:
      1 = note amplitude messages
@@ -334,42 +1076,72 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
      All messages can be suppressed by using message level 16.
      */
     // I suggest: 1 + 2 + 128 + 32 = 163.
-    char buffer[0x200];
-    // Overrride the csd's sample rate.
-    int host_sample_rate = getSampleRate();
-    snprintf(buffer, sizeof(buffer), "--sample-rate=%d", host_sample_rate);
-    csound.SetOption(buffer);
-    // Prevents funny characters from being displaned in Csound messages.
-    snprintf(buffer, sizeof(buffer), "-+msg_color=0");
-    csound.SetOption(buffer);
-    // If there is a csd, compile it.
-    if (csd.length()  > 0) {
-        const char* csd_text = strdup(csd.toRawUTF8());
-        if (csd_text) {
-            auto result = csound.CompileCsdText(csd_text);
-            if (result != 0)
-            {
-                csoundMessage("prepareToPlay: csound.CompileCsdText failed.\n");
-            }
-            std::free((void *)csd_text);
-            result = csound.Start();
-            if (result != 0)
+    render_ahead_blocks = options.render_ahead_blocks;
+    sample_accurate_notes = options.sample_accurate_notes;
+    for (int channel = 1; channel <= 16; ++channel)
+    {
+        note_instruments[size_t(channel)] = channel;
+    }
+    for (const auto &mapping : options.note_instruments)
+    {
+        for (int channel = 1; channel <= 16; ++channel)
+        {
+            if (mapping.first == 0 || mapping.first == channel)
             {
-                csoundMessage("prepareToPlay: csound.Start failed.\n");
+                note_instruments[size_t(channel)] = mapping.second;
             }
         }
     }
-    odbfs = csound.Get0dBFS();
-    iodbfs = 1. / csound.Get0dBFS();
+    coalesce_controllers = options.coalesce_cc;
+    // When bouncing, the host waits for the plugin, so there is nothing to
+    // render ahead of, and ksmps can be traded for quality.
+    offline_rendering = isNonRealtime();
+    offline_ksmps_applied = offline_rendering == true && options.offline_ksmps > 0;
+    realtime_restart_pending = false;
+    buffered_latency_pending = false;
+    if (offline_rendering == true)
+    {
+        render_ahead_blocks = 0;
+    }
+    // The instance that was running is destroyed with previous.
+    HotSwap previous;
+    compileInstance(csd, options, previous);
+    exchangeInstance(previous);
+    csoundMessage(juce::String::formatted("Orchestra channels:     %3d\n", int(current_channel_table->getEntries().size())));
+    if (options.idle_after_seconds > 0 && csound->GetSpout() != nullptr && active_instances_channel == nullptr)
+    {
+        csoundMessage("prepareToPlay: could not create the idle monitor, idle mode is off.\n");
+    }
+    tail_seconds = options.tail_seconds;
+    bindMpeChannels(options);
+    const auto parameters_bound = parameter_bank.bind(*current_channel_table);
+    parameter_bank.setRampFrames(int(options.parameter_smoothing_ms * getSampleRate() / 1000.));
+    csoundMessage(juce::String::formatted("Parameters bound:       %3d\n", parameters_bound));
+    const auto outputs_bound = output_bank.bind(*current_channel_table);
+    csoundMessage(juce::String::formatted("Output parameters bound:%3d\n", outputs_bound));
+    updateHostDisplay(juce::AudioProcessorListener::ChangeDetails().withParameterInfoChanged(true));
+    odbfs = csound->Get0dBFS();
+    iodbfs = 1. / csound->Get0dBFS();
     host_input_channels  = getTotalNumInputChannels();
     host_output_channels = getTotalNumOutputChannels();
-    csound_input_channels = csound.GetNchnlsInput();
-    csound_output_channels = csound.GetNchnls();
+    csound_input_channels = csound->GetNchnlsInput();
+    csound_output_channels = csound->GetNchnls();
     host_frame = 0;
     host_prior_frame = 0;
-    csound_frames = csound.GetKsmps();
-    csound_block_begin = 0;
-    csound_block_end = csound_block_begin + csound_frames;
+    csound_frames = csound->GetKsmps();
+    host_span_frames = std::max(samplesPerBlock, int(csound_frames));
+    // If the host's blocks are whole multiples of ksmps, Csound can render
+    // directly into them; otherwise the rings must be primed with ksmps.
+    // Rendering ahead primes them with the render-ahead blocks as well.
+    direct_rendering = (render_ahead_blocks == 0) && (samplesPerBlock > 0) && (samplesPerBlock % csound_frames == 0);
+    latency_model = LatencyModel::compute(int(csound_frames), host_span_frames, render_ahead_blocks, direct_rendering);
+    audio_input_prefill_frames = latency_model.getPrefillFrames();
+    updateLatency();
+    // The first Csound block consumes only the prefill, so it ends where
+    // the host's first frame begins.
+    csound_block_begin = -audio_input_prefill_frames;
+    csound_block_end = csound_block_begin;
+    csound_block_origin = csound_block_begin;
     host_block_begin = 0;
     const int host_input_busses = getBusCount(true);
     const int host_output_busses = getBusCount(false);
@@ -380,15 +1152,67 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
     csoundMessage(juce::String::formatted("Csound output channels: %3d\n", csound_output_channels));
     csoundMessage(juce::String::formatted("Host output channels:   %3d\n", host_output_channels));
     csoundMessage(juce::String::formatted("Csound ksmps:           %3d\n", csound_frames));
+    csoundMessage(juce::String::formatted("Rendering:              %s%s\n", direct_rendering ? "direct" : render_ahead_blocks > 0 ? "render-ahead" : "buffered", offline_rendering ? ", offline" : ""));
+    csoundMessage(juce::String::formatted("Sample kernels:         %s\n", sample_kernels->name));
+    buildChannelMaps();
+    csoundMessage(juce::String::formatted("Idle after seconds:     %9.4f\n", options.idle_after_seconds));
     drain(midi_input_fifo);
-    drain(audio_input_fifo);
     drain(midi_output_fifo);
-    drain(audio_output_fifo);
+    midi_input_arena.resize(midi_arena_bytes);
+    midi_output_arena.resize(midi_arena_bytes);
+    midi_output_long_message.resize(midi_arena_bytes);
+    note_events.assign(note_events_bytes, '\0');
+    note_events_size = 0;
+    drain(transport_fifo);
+    // Each ring must hold the prefill and a host span, plus up to two ksmps
+    // blocks in flight.
+    const int ring_frames = host_span_frames + audio_input_prefill_frames + 2 * int(csound_frames);
+    audio_input_ring.resize(csound_input_channels, ring_frames);
+    audio_output_ring.resize(csound_output_channels, ring_frames);
+    audio_input_ring.writeSilence(audio_input_prefill_frames);
+    render_ahead_underruns = 0;
+    audio_input_overruns = 0;
+    transport_events_dropped = 0;
+    midi_events_dropped = 0;
+    note_events_dropped = 0;
+    midi_block_events.clear();
+    midi_block_events.reserve(midi_block_events_capacity);
+    midi_block_events_read = 0;
+    midi_events_deferred = 0;
+    midi_superseded.assign(midi_block_events_capacity, 0);
+    controller_last_sequence.fill(-1);
+    controller_last_block.fill(-1);
+    midi_controllers_merged = 0;
+    midi_output_sequence = 0;
+    midi_output_late = 0;
+    idle_after_frames = active_instances_channel != nullptr ? int64_t(options.idle_after_seconds * getSampleRate()) : 0;
+    silent_frames = 0;
+    idle = false;
+    idle_blocks = 0;
+    plugin_frame = 0;
+    midi_input_sequence = 0;
+    if (render_ahead_blocks > 0 && csound->GetSpout() != nullptr)
+    {
+        startRenderAheadThread();
+    }
+    // Play can hot swap a new csd only into a running realtime performance
+    // that the audio thread renders, but changed instruments can be
+    // evaluated in any realtime performance.
+    hot_swap_options = CsoundVST3Options::element(csd);
+    hot_swap_crossfade_frames = 0;
+    if (options.hot_swap_crossfade_ms > 0 && render_ahead_blocks == 0)
+    {
+        hot_swap_crossfade_frames = std::max(int(options.hot_swap_crossfade_ms * getSampleRate() / 1000.), int(csound_frames));
+    }
+    if (offline_rendering == false && csound->GetSpout() != nullptr)
+    {
+        startCompileThread();
+    }
     // TODO: the following is a hack, better try something else.
     auto host_description = plugin_host_type.getHostDescription();
     DBG("Host description: " << host_description);
     auto host = juce::String::formatted("Host: %s\n", host_description);
-    csoundMessage(host.toUTF8());
+    csoundMessage(host);
     if (plugin_host_type.type == juce::PluginHostType::UnknownHost)
     {
         csoundIsPlaying = false;
@@ -401,10 +1225,717 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
         suspendProcessing(false);
         csoundMessage("CsoundVST3AudioProcessor::prepareToPlay: Csound is plqying.\n");
     }
-    plugin_frame = 0;
-    midi_input_sequence = 0;
  }
 
+static_assert(std::is_same<MYFLT, double>::value, "CsoundVST3 requires the 64-bit (double) build of Csound.");
+
+/**
+ * Sends Csound any transport changes that happen before the end of the
+ * Csound block about to be performed. Returns true if there were any.
+ */
+bool CsoundVST3AudioProcessor::applyTransportEvents()
+{
+    bool applied = false;
+    while (auto transport_event = transport_fifo.peek())
+    {
+        if (transport_event->plugin_frame >= csound_block_end)
+        {
+            break;
+        }
+        csound->SetScoreOffsetSeconds(transport_event->score_offset_seconds);
+        transport_fifo.pop();
+        applied = true;
+    }
+    return applied;
+}
+
+/**
+ * Returns true if no sample in the frames is louder than -100 dBFS.
+ */
+static bool isSilent(const MYFLT *frames, size_t samples, double odbfs)
+{
+    const double threshold = odbfs * 1.0e-5;
+    for (size_t sample = 0; sample < samples; ++sample)
+    {
+        if (std::abs(frames[sample]) > threshold)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Performs the Csound block from csound_block_begin to csound_block_end,
+ * with spin already filled. Returns the result of Csound.PerformKsmps.
+ *
+ * In idle mode the block is skipped, and spout is cleared, unless the block
+ * has MIDI or transport events or its input is not silent; Csound then
+ * wakes at exactly the block where that happens, as if it had never
+ * stopped, except that its own clock has not advanced meanwhile.
+ *
+ * A hot swapped Csound instance is swapped in here, before the block, and
+ * so spin and spout may belong to a different instance after this returns.
+ */
+int CsoundVST3AudioProcessor::performKsmps()
+{
+    if (fading_swap == nullptr)
+    {
+        if (auto swap = pending_swap.exchange(nullptr, std::memory_order_acquire))
+        {
+            beginHotSwap(swap);
+        }
+    }
+    auto spin = csound->GetSpin();
+    auto spout = csound->GetSpout();
+    const auto input_samples = size_t(csound_frames) * size_t(csound_input_channels);
+    const auto output_samples = size_t(csound_frames) * size_t(csound_output_channels);
+    auto transport_changed = applyTransportEvents();
+    if (idle == true)
+    {
+        auto midi_message = midi_input_fifo.peek();
+        auto midi_pending = (midi_message != nullptr && midi_message->plugin_frame < csound_block_end) || midi_block_events_read < midi_block_events.size();
+        if (midi_pending == false && transport_changed == false && isSilent(spin, input_samples, odbfs) == true)
+        {
+            std::fill(spout, spout + output_samples, MYFLT(0));
+            ++idle_blocks;
+            return 0;
+        }
+        idle = false;
+        silent_frames = 0;
+    }
+    takeMidiEvents();
+    if (note_events_size > 0)
+    {
+        csound->InputMessage(note_events.data());
+        note_events_size = 0;
+        note_events[0] = '\0';
+    }
+    parameter_bank.writeChanged(int(csound_frames));
+    auto result = csound->PerformKsmps();
+    if (fading_swap != nullptr)
+    {
+        crossfadeHotSwap();
+    }
+    if (result == 0 && idle_after_frames > 0 && active_instances_channel != nullptr)
+    {
+        if (*active_instances_channel <= 0 && isSilent(spin, input_samples, odbfs) && isSilent(spout, output_samples, odbfs))
+        {
+            silent_frames += csound_frames;
+            if (silent_frames >= idle_after_frames)
+            {
+                idle = true;
+            }
+        }
+        else
+        {
+            silent_frames = 0;
+        }
+    }
+    return result;
+}
+
+RenderAheadThread::RenderAheadThread(CsoundVST3AudioProcessor &processor_) : juce::Thread("CsoundVST3 render-ahead"), processor(processor_)
+{
+}
+
+/**
+ * Performs Csound until the output ring is full or the input ring is
+ * empty, then sleeps until processBlock has taken a span of output; the
+ * input prefill lets this run ahead of the host. A notify() that comes
+ * while this is rendering leaves the event signalled, so no span is missed.
+ */
+void RenderAheadThread::run()
+{
+    processor.render_ahead_thread_id = getCurrentThreadId();
+    processor.csoundMessage("Began RenderAheadThread::run()...\n");
+    while (threadShouldExit() == false)
+    {
+        if (processor.csoundIsPlaying == true)
+        {
+            const juce::ScopedLock lock(processor.render_ahead_lock);
+            processor.performBufferedBlocks();
+        }
+        wait(-1);
+    }
+    processor.csoundMessage("Ended RenderAheadThread::run().\n");
+    processor.render_ahead_thread_id = nullptr;
+}
+
+void CsoundVST3AudioProcessor::startRenderAheadThread()
+{
+    auto period_ms = 1000. * host_span_frames / getSampleRate();
+    render_ahead_thread = std::make_unique<RenderAheadThread>(*this);
+    render_ahead_thread->startRealtimeThread(juce::Thread::RealtimeOptions{}.withPeriodMs(period_ms));
+}
+
+void CsoundVST3AudioProcessor::stopRenderAheadThread()
+{
+    if (render_ahead_thread != nullptr)
+    {
+        render_ahead_thread->signalThreadShouldExit();
+        render_ahead_thread->notify();
+        render_ahead_thread->stopThread(2000);
+        render_ahead_thread.reset();
+        if (render_ahead_underruns > 0)
+        {
+            csoundMessage(juce::String::formatted("Render-ahead underruns: %lld\n", (long long) render_ahead_underruns.load()));
+        }
+    }
+}
+
+CompileThread::CompileThread(CsoundVST3AudioProcessor &processor_) : juce::Thread("CsoundVST3 compile"), processor(processor_)
+{
+}
+
+/**
+ * Compiles whatever csd Play has requested, whenever it is notified, and
+ * destroys the instances that hot swaps have retired. The thread that runs
+ * Csound must not notify, since that locks a mutex, so retired instances
+ * are polled for, and destroyed within 100 ms.
+ */
+void CompileThread::run()
+{
+    processor.compile_thread_id = getCurrentThreadId();
+    while (threadShouldExit() == false)
+    {
+        processor.compileHotSwaps();
+        processor.evaluateInstruments();
+        wait(100);
+    }
+    processor.compile_thread_id = nullptr;
+}
+
+void CsoundVST3AudioProcessor::startCompileThread()
+{
+    live_csound = csound.get();
+    live_orchestra = OrchestraBlocks::parse(CsoundVST3Options::strip(csd));
+    compile_thread = std::make_unique<CompileThread>(*this);
+    compile_thread->startThread();
+}
+
+/**
+ * Stops compile_thread, waiting for any compile to finish, and destroys
+ * every Csound instance that is waiting to be swapped in, fading out, or
+ * retired. Only call this when the audio thread is not performing Csound.
+ */
+void CsoundVST3AudioProcessor::stopCompileThread()
+{
+    if (compile_thread != nullptr)
+    {
+        compile_thread->signalThreadShouldExit();
+        compile_thread->notify();
+        compile_thread->stopThread(-1);
+        compile_thread.reset();
+    }
+    {
+        const juce::ScopedLock lock(compile_lock);
+        compile_requested = false;
+        evaluate_requested = false;
+    }
+    live_csound = nullptr;
+    destroyHotSwap(pending_swap.exchange(nullptr, std::memory_order_acq_rel));
+    destroyHotSwap(fading_swap.release());
+    HotSwap *retired_swap = nullptr;
+    while (retired_swaps.try_dequeue(retired_swap))
+    {
+        destroyHotSwap(retired_swap);
+    }
+}
+
+/**
+ * Asks compile_thread to compile the csd for a hot swap. Returns false if
+ * there can be no hot swap, because Csound is not playing, or is not
+ * rendered by the audio thread in realtime, or hot swapping is off.
+ */
+bool CsoundVST3AudioProcessor::requestHotSwap()
+{
+    if (compile_thread == nullptr || hot_swap_crossfade_frames == 0 || csoundIsPlaying == false || isNonRealtime() == true)
+    {
+        return false;
+    }
+    {
+        const juce::ScopedLock lock(compile_lock);
+        compile_csd = csd;
+        compile_requested = true;
+    }
+    csoundMessage("Hot swap: compiling the csd in the background...\n");
+    compile_thread->notify();
+    return true;
+}
+
+/**
+ * compile_thread: destroys retired instances, then compiles the requested
+ * csd, if any, and passes it to the thread that runs Csound. A swap that
+ * has not yet been taken is replaced by the newer one.
+ */
+void CsoundVST3AudioProcessor::compileHotSwaps()
+{
+    HotSwap *retired_swap = nullptr;
+    while (retired_swaps.try_dequeue(retired_swap))
+    {
+        destroyHotSwap(retired_swap);
+    }
+    juce::String requested_csd;
+    {
+        const juce::ScopedLock lock(compile_lock);
+        if (compile_requested == false)
+        {
+            return;
+        }
+        compile_requested = false;
+        requested_csd = compile_csd;
+    }
+    auto swap = std::make_unique<HotSwap>();
+    if (compileHotSwap(requested_csd, *swap) == false)
+    {
+        destroyHotSwap(swap.release());
+        return;
+    }
+    csoundMessage("Hot swap: crossfading to the new orchestra.\n");
+    live_csound = swap->csound.get();
+    live_orchestra = OrchestraBlocks::parse(CsoundVST3Options::strip(requested_csd));
+    destroyHotSwap(pending_swap.exchange(swap.release(), std::memory_order_acq_rel));
+}
+
+/**
+ * Asks compile_thread to compile the selection, if it is not empty, or
+ * else the instruments of the csd that have changed since they were last
+ * compiled, into the running Csound. Returns false if Csound is not
+ * playing in realtime.
+ */
+bool CsoundVST3AudioProcessor::requestEvaluation(const juce::String &csd_, const juce::String &selection)
+{
+    if (compile_thread == nullptr || csoundIsPlaying == false)
+    {
+        csoundMessage("Evaluate: Csound is not playing in realtime, press Play.\n");
+        return false;
+    }
+    {
+        const juce::ScopedLock lock(compile_lock);
+        evaluate_csd = csd_;
+        evaluate_selection = selection;
+        evaluate_requested = true;
+    }
+    compile_thread->notify();
+    return true;
+}
+
+/**
+ * compile_thread: compiles the requested selection, or changed
+ * instruments, into live_csound with csoundCompileOrcAsync, which parses
+ * and compiles here, and leaves only the merge into the running engine to
+ * the thread that performs Csound, at its next ksmps block. Running notes,
+ * global variables and function tables are all kept. Instruments that
+ * have been removed from the csd are not removed from Csound, and changed
+ * global code is not evaluated, since that would reinitialize it. The
+ * instance's messages, while the thread that performs it is also writing
+ * them, go through compile_thread's own queue in csound_messages.
+ */
+void CsoundVST3AudioProcessor::evaluateInstruments()
+{
+    juce::String requested_csd;
+    juce::String selection;
+    {
+        const juce::ScopedLock lock(compile_lock);
+        if (evaluate_requested == false)
+        {
+            return;
+        }
+        evaluate_requested = false;
+        requested_csd = evaluate_csd;
+        selection = evaluate_selection;
+    }
+    if (live_csound == nullptr)
+    {
+        return;
+    }
+    const auto start_ms = juce::Time::getMillisecondCounterHiRes();
+    auto orchestra = OrchestraBlocks::parse(CsoundVST3Options::strip(requested_csd));
+    const auto evaluation = orchestra.evaluate(live_orchestra, selection);
+    if (evaluation.global_code_changed == true)
+    {
+        csoundMessage("Evaluate: the global code has changed, but only instruments are evaluated; press Play for the rest.\n");
+    }
+    if (evaluation.code.isEmpty())
+    {
+        csoundMessage("Evaluate: no instrument has changed.\n");
+        return;
+    }
+    if (csoundCompileOrcAsync(live_csound->GetCsound(), evaluation.code.toRawUTF8()) != 0)
+    {
+        csoundMessage("Evaluate: the code did not compile, the running orchestra goes on.\n");
+        return;
+    }
+    if (selection.isEmpty())
+    {
+        orchestra.mergeInto(live_orchestra);
+    }
+    const auto what = selection.isEmpty() ? "instr " + evaluation.names.joinIntoString(", instr ") : juce::String("the selection");
+    csoundMessage(juce::String::formatted("Evaluate: compiled %s in %.1f ms.\n", what.toRawUTF8(), juce::Time::getMillisecondCounterHiRes() - start_ms));
+}
+
+/**
+ * compile_thread: compiles and starts the csd in a new Csound instance,
+ * and binds the same channels in it as in the running instance. Returns
+ * false if the csd does not compile, in which case the running orchestra
+ * goes on, or if the new orchestra differs from the running one in
+ * anything that was set up by prepareToPlay (CsoundVST3 options, ksmps,
+ * channel counts, 0dBFS, or the channels bound to host parameters), in
+ * which case Csound is restarted on the message thread.
+ */
+bool CsoundVST3AudioProcessor::compileHotSwap(const juce::String &csd_, HotSwap &swap)
+{
+    auto options = CsoundVST3Options::parse(csd_);
+    if (compileInstance(csd_, options, swap) == false)
+    {
+        csoundMessage("Hot swap: the csd did not compile, the running orchestra goes on.\n");
+        return false;
+    }
+    // With the same options, the idle monitor fails only if the running
+    // instance's did.
+    bool compatible = CsoundVST3Options::element(csd_) == hot_swap_options
+                      && swap.csound->GetKsmps() == csound_frames
+                      && swap.csound->GetNchnls() == csound_output_channels
+                      && swap.csound->GetNchnlsInput() == csound_input_channels
+                      && swap.csound->Get0dBFS() == odbfs
+                      && (swap.active_instances_channel != nullptr) == (idle_after_frames > 0)
+                      && parameter_bank.findChannels(*swap.channel_table, swap.parameter_channels) == true
+                      && output_bank.findChannels(*swap.channel_table, swap.output_channels) == true;
+    if (compatible == false)
+    {
+        hot_swap_restart_pending = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Thread that runs Csound: swaps in the new instance, with all of its
+ * channel pointers, and starts the crossfade from the old one. The input
+ * already in the old instance's spin is copied to the new one's. The old
+ * channel table goes with the old instance, and is destroyed with it on
+ * compile_thread: no thread reads a table during performance, and the
+ * table's pointers point into that instance.
+ */
+void CsoundVST3AudioProcessor::beginHotSwap(HotSwap *swap)
+{
+    const auto input_samples = size_t(csound_frames) * size_t(csound_input_channels);
+    auto spin = csound->GetSpin();
+    std::copy(spin, spin + input_samples, swap->csound->GetSpin());
+    exchangeInstance(*swap);
+    parameter_bank.swapChannels(swap->parameter_channels);
+    output_bank.swapChannels(swap->output_channels);
+    fading_swap.reset(swap);
+    crossfade_frames_done = 0;
+    idle = false;
+    silent_frames = 0;
+}
+
+/**
+ * Thread that runs Csound: performs the old instance on the same input as
+ * the new one, which has just been performed, and mixes the two with an
+ * equal-power crossfade into the new instance's spout. When the crossfade
+ * is over, the old instance is handed to compile_thread to be destroyed.
+ */
+void CsoundVST3AudioProcessor::crossfadeHotSwap()
+{
+    auto &old_csound = *fading_swap->csound;
+    if (crossfade_frames_done < hot_swap_crossfade_frames)
+    {
+        const auto input_samples = size_t(csound_frames) * size_t(csound_input_channels);
+        auto spin = csound->GetSpin();
+        std::copy(spin, spin + input_samples, old_csound.GetSpin());
+        if (old_csound.PerformKsmps() == 0)
+        {
+            auto spout = csound->GetSpout();
+            auto old_spout = old_csound.GetSpout();
+            for (int frame = 0; frame < int(csound_frames); ++frame)
+            {
+                const auto position = std::min(double(crossfade_frames_done + frame + 1) / double(hot_swap_crossfade_frames), 1.);
+                const auto fade_in = MYFLT(std::sin(position * juce::MathConstants<double>::halfPi));
+                const auto fade_out = MYFLT(std::cos(position * juce::MathConstants<double>::halfPi));
+                for (int channel = 0; channel < csound_output_channels; ++channel)
+                {
+                    const auto sample = size_t(frame * csound_output_channels + channel);
+                    spout[sample] = spout[sample] * fade_in + old_spout[sample] * fade_out;
+                }
+            }
+            crossfade_frames_done += int(csound_frames);
+        }
+        else
+        {
+            crossfade_frames_done = hot_swap_crossfade_frames;
+        }
+    }
+    // If retired_swaps is full, this is tried again at the next block.
+    // compile_thread polls retired_swaps, and is not notified.
+    if (crossfade_frames_done >= hot_swap_crossfade_frames && retired_swaps.try_enqueue(fading_swap.get()) == true)
+    {
+        fading_swap.release();
+    }
+}
+
+/**
+ * Cleans up and destroys a Csound instance that is not, or is no longer,
+ * performing. Never call this on the audio thread.
+ */
+void CsoundVST3AudioProcessor::destroyHotSwap(HotSwap *swap)
+{
+    if (swap == nullptr)
+    {
+        return;
+    }
+    if (swap->csound != nullptr)
+    {
+        swap->csound->Cleanup();
+    }
+    delete swap;
+}
+
+/**
+ * Runs Csound for as many ksmps blocks as audio_input_ring can supply and
+ * audio_output_ring can accept. Each block's spin is filled from the input
+ * ring, and its spout is pushed onto the output ring, with one bulk copy
+ * each. Returns false if Csound has ended the performance.
+ */
+bool CsoundVST3AudioProcessor::performBufferedBlocks()
+{
+    while (audio_input_ring.readable() >= csound_frames && audio_output_ring.writable() >= csound_frames)
+    {
+        audio_input_ring.read(csound->GetSpin(), int(csound_frames));
+        csound_block_begin = csound_block_end;
+        csound_block_end = csound_block_begin + csound_frames;
+        auto result = performKsmps();
+        if (result != 0)
+        {
+            csoundIsPlaying = false;
+            return false;
+        }
+        audio_output_ring.write(csound->GetSpout(), int(csound_frames));
+    }
+    return true;
+}
+
+/**
+ * Renders a host block that is a whole number of ksmps blocks by calling
+ * Csound.PerformKsmps in place: the host's input goes straight into spin,
+ * and spout goes straight into the host's output, with no FIFOs and no
+ * latency.
+ */
+template<typename Sample>
+void CsoundVST3AudioProcessor::renderDirect(juce::AudioBuffer<Sample> &host_audio_buffer)
+{
+    const int host_audio_buffer_frames = host_audio_buffer.getNumSamples();
+    int block_begin = 0;
+    for ( ; block_begin < host_audio_buffer_frames && csoundIsPlaying == true; block_begin += int(csound_frames))
+    {
+        sample_kernels->interleave_frames(input_channel_map.getChannels(host_audio_buffer, block_begin), csound_input_channels, 0, csound->GetSpin(), csound_input_channels, int(csound_frames), odbfs);
+        csound_block_begin = plugin_frame;
+        csound_block_end = csound_block_begin + csound_frames;
+        auto result = performKsmps();
+        if (result != 0)
+        {
+            csoundIsPlaying = false;
+            break;
+        }
+        sample_kernels->deinterleave_frames(csound->GetSpout(), csound_output_channels, output_channel_map.getChannels(host_audio_buffer, block_begin), csound_output_channels, 0, int(csound_frames), iodbfs);
+        plugin_frame += csound_frames;
+    }
+    // If Csound has stopped, the rest of the block is silent.
+    if (block_begin < host_audio_buffer_frames)
+    {
+        host_audio_buffer.clear(block_begin, host_audio_buffer_frames - block_begin);
+        plugin_frame += host_audio_buffer_frames - block_begin;
+    }
+    clearUnmappedOutputs(host_audio_buffer);
+    measured_latency_frames = 0;
+}
+
+/**
+ * Clears host channels that Csound does not write.
+ */
+template<typename Sample>
+void CsoundVST3AudioProcessor::clearUnmappedOutputs(juce::AudioBuffer<Sample> &host_audio_buffer)
+{
+    for (auto channel : unmapped_output_channels)
+    {
+        if (channel < host_audio_buffer.getNumChannels())
+        {
+            host_audio_buffer.clear(channel, 0, host_audio_buffer.getNumSamples());
+        }
+    }
+}
+
+/**
+ * Renders a host block of any size through audio_input_ring and
+ * audio_output_ring, in spans of at most host_span_frames.
+ */
+template<typename Sample>
+void CsoundVST3AudioProcessor::renderBuffered(juce::AudioBuffer<Sample> &host_audio_buffer)
+{
+    const int host_audio_buffer_frames = host_audio_buffer.getNumSamples();
+    for (int span_begin = 0; span_begin < host_audio_buffer_frames; )
+    {
+        const int span_frames = std::min(host_audio_buffer_frames - span_begin, host_span_frames);
+        // Push the span's audio input onto the input ring...
+        auto input_spans = audio_input_ring.writeSpans(span_frames);
+        sample_kernels->interleave_frames(input_channel_map.getChannels(host_audio_buffer, span_begin), csound_input_channels, 0, input_spans.first.data, csound_input_channels, input_spans.first.frames, odbfs);
+        sample_kernels->interleave_frames(input_channel_map.getChannels(host_audio_buffer, span_begin + input_spans.first.frames), csound_input_channels, 0, input_spans.second.data, csound_input_channels, input_spans.second.frames, odbfs);
+        const int input_frames = input_spans.first.frames + input_spans.second.frames;
+        audio_input_ring.commitWrite(input_frames);
+        // The input that did not fit is lost, so the plugin's timeline
+        // advances only by the frames that Csound will actually see.
+        if (input_frames < span_frames)
+        {
+            ++audio_input_overruns;
+        }
+        // ...perform every whole ksmps block that is now available, unless
+        // the render-ahead thread does it. Offline, the host waits for the
+        // plugin, so rather than underrun, render here in its place (it runs
+        // only if the host went offline without calling prepareToPlay).
+        if (render_ahead_thread == nullptr)
+        {
+            if (csoundIsPlaying == true)
+            {
+                performBufferedBlocks();
+            }
+        }
+        else if (isNonRealtime() == true && csoundIsPlaying == true)
+        {
+            const juce::ScopedLock lock(render_ahead_lock);
+            performBufferedBlocks();
+        }
+        // ...and pop the span's audio output from the output ring.
+        auto output_spans = audio_output_ring.readSpans(span_frames);
+        sample_kernels->deinterleave_frames(output_spans.first.data, csound_output_channels, output_channel_map.getChannels(host_audio_buffer, span_begin), csound_output_channels, 0, output_spans.first.frames, iodbfs);
+        sample_kernels->deinterleave_frames(output_spans.second.data, csound_output_channels, output_channel_map.getChannels(host_audio_buffer, span_begin + output_spans.first.frames), csound_output_channels, 0, output_spans.second.frames, iodbfs);
+        const int output_frames = output_spans.first.frames + output_spans.second.frames;
+        audio_output_ring.commitRead(output_frames);
+        // There is room in the output ring again.
+        if (render_ahead_thread != nullptr)
+        {
+            render_ahead_thread->notify();
+        }
+        if (output_frames < span_frames)
+        {
+            host_audio_buffer.clear(span_begin + output_frames, span_frames - output_frames);
+            if (render_ahead_thread != nullptr)
+            {
+                ++render_ahead_underruns;
+            }
+            else if (csoundIsPlaying == true)
+            {
+                DBG("processBlock: WARNING! Audio output ring is empty but shouldn't be!");
+            }
+        }
+        span_begin += span_frames;
+        plugin_frame += input_frames;
+    }
+    clearUnmappedOutputs(host_audio_buffer);
+    // Every frame now in the rings is a frame of delay.
+    measured_latency_frames = audio_input_ring.readable() + audio_output_ring.readable();
+}
+
+/**
+ * Switches from direct to buffered rendering in the middle of performance.
+ * The input ring is primed with ksmps frames of silence, exactly as
+ * prepareToPlay would have done, and buffered_latency_pending asks the
+ * message thread to report the new latency to the host.
+ */
+void CsoundVST3AudioProcessor::fallBackToBufferedRendering()
+{
+    direct_rendering = false;
+    audio_input_ring.clear();
+    audio_output_ring.clear();
+    audio_input_prefill_frames = LatencyModel::compute(int(csound_frames), host_span_frames, 0, false).getPrefillFrames();
+    audio_input_ring.writeSilence(audio_input_prefill_frames);
+    csound_block_begin = plugin_frame - audio_input_prefill_frames;
+    csound_block_end = csound_block_begin;
+    csound_block_origin = csound_block_begin;
+    buffered_latency_pending = true;
+}
+
+/**
+ * Message thread: does the work that the audio and compile threads cannot
+ * do themselves, and have flagged. Flags are polled rather than signalled,
+ * because signalling the message thread can lock or allocate.
+ */
+void CsoundVST3AudioProcessor::timerCallback()
+{
+    if (hot_swap_restart_pending.exchange(false) == true)
+    {
+        csoundMessage("Hot swap: the new csd cannot be swapped in, restarting Csound...\n");
+        restart();
+        return;
+    }
+    if (realtime_restart_pending == true)
+    {
+        csoundMessage("Host has returned to realtime rendering, restarting Csound...\n");
+        suspendProcessing(true);
+        prepareToPlay(getSampleRate(), getBlockSize());
+        return;
+    }
+    if (buffered_latency_pending.exchange(false) == true)
+    {
+        csoundMessage("Host block is not a multiple of ksmps, using buffered rendering.\n");
+        latency_model = LatencyModel::compute(int(csound_frames), host_span_frames, 0, false);
+        updateLatency();
+    }
+}
+
+/**
+ * Reports the latency model's delay to the host, which will then adjust its
+ * delay compensation. Called on the message thread after every compile, and
+ * after falling back from direct to buffered rendering.
+ */
+void CsoundVST3AudioProcessor::updateLatency()
+{
+    auto latency_frames = latency_model.getPrefillFrames();
+    csoundMessage(juce::String::formatted("Latency frames:         %3d (ksmps %d, buffering %d, render-ahead %d)\n", latency_frames, latency_model.ksmps, latency_model.buffering_frames, latency_model.render_ahead_frames));
+    reported_latency_frames = latency_frames;
+    if (getLatencySamples() != latency_frames)
+    {
+        setLatencySamples(latency_frames);
+    }
+}
+
+/**
+ * Returns the reported and measured latency for display in the editor.
+ */
+juce::String CsoundVST3AudioProcessor::getLatencyStatus() const
+{
+    auto reported = reported_latency_frames.load();
+    auto measured = measured_latency_frames.load();
+    auto sample_rate = getSampleRate();
+    auto milliseconds = sample_rate > 0 ? (1000. * reported / sample_rate) : 0.;
+    auto status = juce::String::formatted("Latency: %d frames (%.2f ms), measured %d", reported, milliseconds, measured);
+    if (idle == true)
+    {
+        status << ", idle";
+    }
+    return status;
+}
+
+/**
+ * Returns the output parameters' names and values for display in the
+ * editor. The values are read lock-free, as last sampled by processBlock.
+ */
+juce::String CsoundVST3AudioProcessor::getOutputStatus() const
+{
+    juce::String status;
+    for (int index = 0; index < output_bank.size(); ++index)
+    {
+        const auto &parameter = output_bank[index];
+        if (status.isNotEmpty())
+        {
+            status << "  ";
+        }
+        status << parameter.getName(64) << ": " << juce::String(parameter.getPlainValue(), 3);
+    }
+    return status;
+}
+
 /**
  * Calls csoundPerformKsmps to do the actual processing.
  *
@@ -413,24 +1944,52 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
  * and may not be the same on every call. Input data in the host's  buffers is
  * replaced by output data, or cleared.
  *
- * This implementation uses MoodyCamel's ReaderWriterQueue as FIFOs
- * for synchronizing these potential mismatches.
+ * This implementation uses MoodyCamel's ReaderWriterQueue as FIFOs for MIDI,
+ * and preallocated rings of interleaved frames for audio, for synchronizing
+ * these potential mismatches.
  *
- * In each processBlock call,, the incoming buffers  first have their data
- * pushed onto midi_input_fifo and audio_input_fifo., after which the host's
- * MidiBuffer and AudioBuffer are immediately  cleared. Whenever ksmps frames
- * of audio have been processed, Csound. performKsmps is called, during
- * which sensEvents calls the plugin's MIDI read callback, in which  MIDI
- * messages copied to Csound, and the plugin's MIDI write callback, which
- * pushes  MIDI mrssages from  Csound onto midi_output_fifo. Then, spout
- * is pushed onto audio_output_fifo. These thiings  can happen at any time,
- * and any number of times, during the processBlock call.. processBlock then
- * pops MIDI messages from midi_output_fifo into the hostt's empty
- * MidiBuffer, and pops audio from audio_output_fifo onto the host's empty
- * AudioBuffer. When that is full, processBlock returns.,
+ * In each processBlock call, the incoming MIDI messages are first pushed onto
+ * midi_input_fifo, after which the host's MidiBuffer is cleared. The host
+ * block is then processed in spans of at most host_span_frames. Each span of
+ * input audio is pushed onto audio_input_ring, and then Csound.PerformKsmps
+ * is called for every whole ksmps block that the ring holds, during which
+ * sensEvents calls the plugin's MIDI read callback, in which MIDI messages
+ * are copied to Csound, and the plugin's MIDI write callback, which pushes
+ * MIDI messages from Csound onto midi_output_fifo. Then, spout is pushed
+ * onto audio_output_ring, and the span is filled from that ring.
+ *
+ * Because audio_input_ring is prefilled with ksmps frames of silence, the
+ * output ring always holds at least a span of audio by the time it is read,
+ * and the plugin's latency is exactly ksmps frames.
+ *
+ * When the host's block size is a whole multiple of ksmps, none of this is
+ * needed: renderDirect performs Csound in place on the host's buffer with
+ * zero latency, falling back to the rings if the host ever sends a block of
+ * some other size.
+ *
+ * Csound computes in double precision, so hosts that also process in double
+ * precision call the double overload, and samples are then only
+ * (de)interleaved, never converted.
  */
 void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audio_buffer, juce::MidiBuffer& host_midi_buffer)
 {
+    renderBlock(host_audio_buffer, host_midi_buffer);
+}
+
+void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<double>& host_audio_buffer, juce::MidiBuffer& host_midi_buffer)
+{
+    renderBlock(host_audio_buffer, host_midi_buffer);
+}
+
+bool CsoundVST3AudioProcessor::supportsDoublePrecisionProcessing() const
+{
+    return true;
+}
+
+template<typename Sample>
+void CsoundVST3AudioProcessor::renderBlock(juce::AudioBuffer<Sample> &host_audio_buffer, juce::MidiBuffer &host_midi_buffer)
+{
+    audio_thread_id.store(juce::Thread::getCurrentThreadId(), std::memory_order_relaxed);
     auto play_head = getPlayHead();
     auto play_head_position = play_head->getPosition();
     if (csoundIsPlaying == false)
@@ -447,151 +2006,140 @@ void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audi
     synchronizeScore(play_head_position);
     juce::ScopedNoDenormals noDenormals;
     auto host_audio_buffer_frames = host_audio_buffer.getNumSamples();
-    host_block_begin = host_frame;
+    // MIDI messages are stamped with frames counting from the beginning of
+    // performance, the same time line that Csound blocks are counted on.
+    host_block_begin = plugin_frame;
     host_block_end = host_block_begin + host_audio_buffer_frames;
-    // Csound reads audio input from this buffer.
-    auto spin = csound.GetSpin();
     // Csound writes audio output to this buffer.
-    auto spout = csound.GetSpout();
+    auto spout = csound->GetSpout();
     if (spout == nullptr)
     {
         csoundMessage("Null spout...\n");
         return;
     }
-    auto host_audio_input_buffer = getBusBuffer(host_audio_buffer, true, 0);
-    auto host_audio_output_buffer = getBusBuffer(host_audio_buffer, false, 0);
     
     // Csound's spin and spout buffers are indexed [frame][channel].
     // The host audio buffer is indexed [channel][frame].
-    // As far as I can tell, both `getWritePointer` and `setSample` mark the
-    // host audio buffer as not clear, and have the same addresses for the
-    // same elements. The host buffer channel count is the greater of (inputs
+    // The host buffer channel count is the greater of (inputs
     // + side chains) and outputs. Input channels are followed by side chain
     // channels. Output channels overlap inputs and possibly side chains.
-    // (CsoundVST3 does not use side chains.) The getBusBuffer function
-    // gathers the appropriate channel pointers into a channel array for
-    // the indicated buffer, but care must be used to respect the outputs
-    // overlapping other channels.
+    // input_channel_map and output_channel_map, like getBusBuffer, gather
+    // the appropriate channel pointers for each bus; the side chain simply
+    // supplies the Csound input channels after those of the main input.
+    // Each span is read completely before it is overwritten, so the overlap
+    // is harmless.
         
+    // A host block that is not a whole number of ksmps blocks ends direct
+    // rendering until the next prepareToPlay. This is decided before any
+    // MIDI is stamped, since falling back moves the Csound block origin
+    // that controller coalescing groups events by.
+    if (direct_rendering == true && (host_audio_buffer_frames % csound_frames) != 0)
+    {
+        fallBackToBufferedRendering();
+    }
     // Push all inputs onto FIFOs. Here, frame is the frame of the message
-    // counting from the beginning of performance. Only MIDI channel messages
-    // are handled, although these can of course include PRNs and NPRNs.
+    // counting from the beginning of performance. System Exclusive messages
+    // go through midi_input_arena, so that no message is too long and none
+    // allocates.
     int input_messages = 0;
     int output_messages = 0;
+    const int superseded_events = coalesce_controllers == true ? std::min(host_midi_buffer.getNumEvents(), int(midi_superseded.size())) : 0;
+    if (superseded_events > 0)
+    {
+        markSupersededControllers(host_midi_buffer);
+    }
+    int event_index = 0;
     for (const auto metadata : host_midi_buffer)
     {
-        auto message = metadata.getMessage();
-        MidiChannelMessage channel_message;
-        channel_message.sequence = midi_input_sequence++;
-        channel_message.message = message;
-        channel_message.plugin_frame = host_block_begin + metadata.samplePosition;
-        channel_message.csound_frame = channel_message.plugin_frame % csound_frames;
-        
+        if (event_index < superseded_events && midi_superseded[size_t(event_index)] != 0)
+        {
+            ++event_index;
+            ++midi_input_sequence;
+            ++midi_controllers_merged;
+            continue;
+        }
+        ++event_index;
+        MidiEvent midi_event;
+        midi_event.sequence = midi_input_sequence++;
+        midi_event.plugin_frame = host_block_begin + metadata.samplePosition;
         auto status = metadata.data[0];
-        // We process only MIDI channel messages.
-        if ((0x80 <= status) && (status <= 0xE0))        {
-             midi_input_fifo.enqueue(channel_message);
+        // Channel, system common, system realtime and System Exclusive
+        // messages all go to Csound.
+        if (metadata.numBytes > 0 && status >= 0x80)
+        {
+            if (enqueueMidiEvent(midi_input_fifo, midi_input_arena, midi_event, metadata.data, metadata.numBytes) == false)
+            {
+                ++midi_events_dropped;
+            }
 #if defined(JUCE_DEBUG)
             if (fifo_debug == true)
             {
                 input_messages++;
                 char buffer[0x200];
                 // The channel message frame must be in [host_block_begin, host_block_end).
-                auto tyme = plugin_frame / float(csound.GetSr());
-                assert(channel_message.plugin_frame >= host_block_begin && channel_message.plugin_frame < host_block_end);
+                auto tyme = plugin_frame / float(csound->GetSr());
+                assert(midi_event.plugin_frame >= host_block_begin && midi_event.plugin_frame < host_block_end);
                 std::snprintf(buffer, sizeof(buffer),
-                              "Host processBlock #%5lld: time:%9.4f host begin%8llu plugin%8llu msg%8llu cs%8llu host end%8llu  %s", channel_message.sequence, tyme, host_block_begin, plugin_frame, channel_message.plugin_frame, channel_message.csound_frame, host_block_end, message.getDescription().toRawUTF8());
+                              "Host processBlock #%5lld: time:%9.4f host begin%8llu plugin%8llu msg%8llu cs%8llu host end%8llu  %s", midi_event.sequence, tyme, host_block_begin, plugin_frame, midi_event.plugin_frame, midi_event.plugin_frame % csound_frames, host_block_end, metadata.getMessage().getDescription().toRawUTF8());
                 DBG(buffer);
             }
 #endif
         }
     }
     host_midi_buffer.clear();
-    for (int host_audio_buffer_frame = 0; host_audio_buffer_frame < host_audio_buffer_frames; ++host_audio_buffer_frame)
+    // Offline settings must not outlive the bounce.
+    if (offline_rendering == true && isNonRealtime() == false && offline_ksmps_applied == true && realtime_restart_pending == false)
     {
-        for (int host_audio_buffer_channel = 0; host_audio_buffer_channel < host_input_channels; ++host_audio_buffer_channel)
-        {
-            auto sample = host_audio_buffer.getSample(host_audio_buffer_channel, host_audio_buffer_frame);
-            audio_input_fifo.enqueue(sample);
-        }
+        realtime_restart_pending = true;
+    }
+    if (direct_rendering == true)
+    {
+        renderDirect(host_audio_buffer);
+    }
+    else
+    {
+        renderBuffered(host_audio_buffer);
     }
-    host_audio_buffer.clear();
-    // FIFOs being loaded, now process.
-    // The host block pops audio input...
-    for (host_audio_buffer_frame = 0; host_audio_buffer_frame < host_audio_buffer_frames; ++host_audio_buffer_frame, ++host_frame, ++csound_frame, ++plugin_frame)
+    output_bank.sample();
+    // Processing of the host block being completed, now pop from the MIDI
+    // output FIFO every message due before the end of this host block, at
+    // its own offset in the block. The FIFO is in frame order, so this stops
+    // at the first message for a later block, which stays in the FIFO. A
+    // message that was due in an earlier block (which can only happen when
+    // the latency has changed) goes out at the start of this block, and is
+    // counted as late.
+    while (auto message = midi_output_fifo.peek())
     {
-        int channel_index;
-        csound_frame = plugin_frame % csound_frames;
-        for (channel_index = 0; channel_index < host_input_channels; channel_index++)
+        if (message->plugin_frame >= host_block_end)
         {
-            float sample = 0;
-            if (audio_input_fifo.try_dequeue(sample))
-            {
-                sample = sample * odbfs;
-            }
-            spin[(csound_frame * csound_input_channels) + channel_index] = double(sample);
+            break;
         }
-        // ...until spin is full...
-        if (csound_frame == 0)
+        auto timestamp = message->plugin_frame - host_block_begin;
+        if (timestamp < 0)
         {
-            csound_block_begin = plugin_frame;
-            csound_block_end = plugin_frame + csound_frames;
-            auto result = csound.PerformKsmps();
-            if (result != 0) {
-                csoundIsPlaying = false;
-            }
-            for (int csound_block_frame = 0; csound_block_frame < csound_frames; ++csound_block_frame)
-            {
-                for (int csound_output_channel = 0; csound_output_channel < csound_output_channels; ++csound_output_channel)
-                {
-                    auto sample = iodbfs * spout[(csound_block_frame * csound_output_channels) + csound_output_channel];
-                    audio_output_fifo.enqueue(sample);
-                }
-            }
+            timestamp = 0;
+            ++midi_output_late;
         }
-    }
-    // Processing of the host block being completed,
-    // now pop from the output FIFOs until JUCE outputs are full.
-    while (true)
-    {
-        auto message = midi_output_fifo.peek();
-        if (message == nullptr)
+        if (message->isLongMessage() == true)
         {
-            break;
+            auto size = midi_output_arena.read(midi_output_long_message.data(), message->getLength());
+            host_midi_buffer.addEvent(midi_output_long_message.data(), size, int(timestamp));
         }
-        if ((message->plugin_frame >= host_block_begin) && (message->plugin_frame < host_block_end))
+        else
         {
-            auto timestamp = message->plugin_frame - host_block_begin;
-            host_midi_buffer.addEvent(message->message, int(timestamp));
-            midi_output_fifo.pop();
-#if defined(JUCE_DEBUG)
-            if (fifo_debug == true)
-            {
-                output_messages++;
-                char buffer[0x200];
-                std::snprintf(buffer, sizeof(buffer),
-                              "MIDI output to host#%5d: frame%8llu timestamp%8llu csound: begin%8llu frame %8llu %8llu end%8llu %s", output_messages, plugin_frame, timestamp, csound_block_begin, plugin_frame, csound_frame, csound_block_end, message->message.getDescription().toRawUTF8());
-                DBG(buffer);
-            }
-#endif
+            host_midi_buffer.addEvent(message->getData(), message->getSize(), int(timestamp));
         }
-    }
-    for (int host_audio_buffer_frame = 0; host_audio_buffer_frame < host_audio_buffer_frames; ++host_audio_buffer_frame)
-    {
-        for (int host_output_channel = 0; host_output_channel < host_output_channels; ++host_output_channel)
+#if defined(JUCE_DEBUG)
+        if (fifo_debug == true)
         {
-            // TODO: This is a hack.
-            auto sample = audio_output_fifo.peek();
-            if (sample != nullptr)
-            {
-                host_audio_buffer.setSample(host_output_channel, host_audio_buffer_frame, iodbfs * *sample);
-                audio_output_fifo.pop();
-            }
-            else
-            {
-                DBG("processBlock: WARNING! Audio output FIFO is empty but shouldn't be!");
-            }
+            output_messages++;
+            char buffer[0x200];
+            std::snprintf(buffer, sizeof(buffer),
+                          "MIDI output to host#%5lld: frame%8llu timestamp%8llu csound: begin%8llu frame %8llu %8llu end%8llu %s", message->sequence, plugin_frame, timestamp, csound_block_begin, message->plugin_frame, csound_frame, csound_block_end, message->isLongMessage() ? "System Exclusive" : juce::MidiMessage(message->getData(), message->getSize()).getDescription().toRawUTF8());
+            DBG(buffer);
         }
+#endif
+        midi_output_fifo.pop();
     }
 }
 
@@ -611,6 +2159,17 @@ void CsoundVST3AudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
     juce::ValueTree state("CsoundVstState");
     state.setProperty("csd", csd, nullptr);
+    for (int index = 0; index < ParameterBank::capacity; ++index)
+    {
+        auto &parameter = parameter_bank[index];
+        if (parameter.isBound() == true)
+        {
+            juce::ValueTree parameter_state("Parameter");
+            parameter_state.setProperty("name", parameter.getName(1024), nullptr);
+            parameter_state.setProperty("value", double(parameter.getValue()), nullptr);
+            state.appendChild(parameter_state, nullptr);
+        }
+    }
     juce::MemoryOutputStream stream(destData, false);
     state.writeToStream(stream);
 }
@@ -622,6 +2181,14 @@ void CsoundVST3AudioProcessor::setStateInformation (const void* data, int sizeIn
     if (state.isValid() && state.hasType("CsoundVstState"))
     {
         csd = state.getProperty("csd", "").toString();
+        for (const auto &parameter_state : state)
+        {
+            const auto name = parameter_state.getProperty("name").toString();
+            if (parameter_state.hasType("Parameter") && name.isNotEmpty())
+            {
+                parameter_bank.restore(name, float(double(parameter_state.getProperty("value", 0.0))));
+            }
+        }
         auto editor = getActiveEditor();
         if (editor) {
             auto pluginEditor = reinterpret_cast<CsoundVST3AudioProcessorEditor *>(editor);
@@ -637,7 +2204,23 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
     return new CsoundVST3AudioProcessor();
 }
 
+/**
+ * Replaces the running orchestra with the csd: by hot swapping it in, if
+ * that is possible, or else by restarting Csound.
+ */
 void CsoundVST3AudioProcessor::play()
+{
+    if (requestHotSwap() == true)
+    {
+        return;
+    }
+    restart();
+}
+
+/**
+ * Stops Csound, then compiles the csd and starts Csound again.
+ */
+void CsoundVST3AudioProcessor::restart()
 {
     stop();
     suspendProcessing(false);
@@ -649,10 +2232,49 @@ void CsoundVST3AudioProcessor::play()
 void CsoundVST3AudioProcessor::stop()
 {
     suspendProcessing(true);
+    stopRenderAheadThread();
+    stopCompileThread();
+    if (audio_input_overruns > 0)
+    {
+        csoundMessage(juce::String::formatted("Audio input overruns:   %lld\n", (long long) audio_input_overruns.load()));
+    }
+    if (transport_events_dropped > 0)
+    {
+        csoundMessage(juce::String::formatted("Transport events dropped:%lld\n", (long long) transport_events_dropped.load()));
+    }
+    if (midi_events_dropped > 0)
+    {
+        csoundMessage(juce::String::formatted("MIDI events dropped:    %lld\n", (long long) midi_events_dropped.load()));
+    }
+    if (note_events_dropped > 0)
+    {
+        csoundMessage(juce::String::formatted("Note events dropped:    %lld\n", (long long) note_events_dropped.load()));
+    }
+    if (midi_controllers_merged > 0)
+    {
+        csoundMessage(juce::String::formatted("MIDI controllers merged:%lld\n", (long long) midi_controllers_merged.load()));
+    }
+    if (midi_events_deferred > 0)
+    {
+        csoundMessage(juce::String::formatted("MIDI events deferred:   %lld\n", (long long) midi_events_deferred.load()));
+    }
+    if (midi_output_late > 0)
+    {
+        csoundMessage(juce::String::formatted("MIDI output late:       %lld\n", (long long) midi_output_late.load()));
+    }
+    if (idle_blocks > 0)
+    {
+        csoundMessage(juce::String::formatted("Idle blocks skipped:    %lld\n", (long long) idle_blocks.load()));
+    }
+    const auto messages_dropped = csound_messages.takeDropped();
+    if (messages_dropped > 0)
+    {
+        csoundMessage(juce::String::formatted("Messages dropped:       %lld\n", (long long) messages_dropped));
+    }
     csoundIsPlaying = false;
-    csound.Stop();
-    csound.Cleanup();
-    csound.Reset();
+    csound->Stop();
+    csound->Cleanup();
+    csound->Reset();
 }
 
 
@@ -8,36 +8,239 @@
 #include <juce_gui_extra/juce_gui_extra.h>
 #include "csound_threaded.hpp"
 #include "readerwriterqueue.h"
+#include "channel_map.h"
+#include "channel_table.h"
+#include "frame_ring_buffer.h"
+#include "message_queues.h"
+#include "mpe_zones.h"
+#include "orchestra_blocks.h"
+#include "parameter_bank.h"
+#include "sample_kernels.h"
+#include "sysex_arena.h"
+#include "csoundvst3_options.h"
 #include "csoundvst3_version.h"
 
 #include <iostream>
+#include <array>
 #include <numeric>
+#include <type_traits>
 
 #ifndef SIGTRAP
 #define SIGTRAP 5
 #endif
 
-class MidiChannelMessage
+/**
+ * A MIDI message stamped with the frame, counting from the beginning of the
+ * plugin's performance, at which it happens. This is a plain, trivially
+ * copyable record of fixed size, so that moving MIDI through the FIFOs
+ * never allocates or reference counts.
+ *
+ * Short messages (one to three bytes) are stored in the record itself. For
+ * System Exclusive messages, size is 0, and the long_message_size bytes are
+ * the next bytes in the SysexArena that travels with the FIFO;
+ * long_message_offset is where they begin, for sanity checks.
+ */
+class MidiEvent
 {
 public:
     /**
      * This is the frame counting from the beginning of the plugin's
-     * performance, which is used to find whether this essage falls within the
-     * current Csound block and should be handled in the MIDI read callback.
+     * performance, which is used to find whether this message falls within
+     * the current Csound block and should be handled in the MIDI read
+     * callback, or within the current host block and should be sent to the
+     * host.
      */
     int64_t plugin_frame = 0;
     /**
-     * This is a sanity check on position in the spout buffer.
+     * A sanity check to see if we are missing or duplicating messages.
      */
-    int64_t csound_frame = 0;
+    int64_t sequence = 0;
+    uint32_t long_message_offset = 0;
+    uint32_t long_message_size = 0;
+    uint8_t size = 0;
+    uint8_t data[3] = {0, 0, 0};
+    const uint8_t *getData() const
+    {
+        return data;
+    }
+    int getSize() const
+    {
+        return size;
+    }
+    bool isLongMessage() const
+    {
+        return size == 0;
+    }
     /**
-     * Another sanity check to see if we are missing or duplicating mesaages.
+     * Returns the length of the message in bytes, long or short.
      */
-    int64_t sequence = 0;
-    juce::MidiMessage message;
+    int getLength() const
+    {
+        return isLongMessage() ? int(long_message_size) : int(size);
+    }
+    /**
+     * Stores a short message; returns false if it is too long.
+     */
+    bool setShortMessage(const uint8_t *bytes, int byte_count)
+    {
+        if (byte_count < 1 || byte_count > 3)
+        {
+            return false;
+        }
+        size = uint8_t(byte_count);
+        for (int i = 0; i < byte_count; ++i)
+        {
+            data[i] = bytes[i];
+        }
+        return true;
+    }
+    /**
+     * Returns the length of the MIDI message that begins with this status
+     * byte, or 0 for System Exclusive, whose length is not fixed, or for
+     * data bytes.
+     */
+    static int getMessageSize(uint8_t status)
+    {
+        if (status < 0x80)
+        {
+            return 0;
+        }
+        if (status < 0xF0)
+        {
+            const auto type = status & 0xF0;
+            return (type == 0xC0 || type == 0xD0) ? 2 : 3;
+        }
+        switch (status)
+        {
+        case 0xF0:
+            return 0;
+        case 0xF1:
+        case 0xF3:
+            return 2;
+        case 0xF2:
+            return 3;
+        default:
+            return 1;
+        }
+    }
+};
+
+static_assert(std::is_trivially_copyable<MidiEvent>::value, "MidiEvent must be trivially copyable.");
+
+/**
+ * A MIDI control change bound directly to a Csound control channel. The
+ * controller's 0 to 127 is scaled to [minimum, minimum + range] and written
+ * through the channel's cached value pointer.
+ */
+class ControllerBinding
+{
+public:
+    MYFLT *channel_pointer = nullptr;
+    MYFLT minimum = 0;
+    MYFLT range = 1;
+};
+
+/**
+ * A change in the host's transport, such as a loop back to the beginning,
+ * stamped with the plugin frame at which it happened, so that it reaches
+ * Csound in the right Csound block even when Csound runs on another thread.
+ */
+class TransportEvent
+{
+public:
+    int64_t plugin_frame = 0;
+    double score_offset_seconds = 0;
+};
+
+/**
+ * Accounts for the plugin's input-to-output delay in frames. Csound reads its
+ * input from audio_input_ring after a prefill of silence, and that prefill is
+ * the whole of the delay: none for direct rendering, one ksmps for buffered
+ * rendering, and for rendering ahead, one ksmps plus enough whole ksmps
+ * blocks to cover the render-ahead host blocks. This is computed from the
+ * compiled ksmps, so it is only valid after the csd has been compiled.
+ */
+class LatencyModel
+{
+public:
+    int ksmps = 0;
+    int buffering_frames = 0;
+    int render_ahead_frames = 0;
+    int getPrefillFrames() const
+    {
+        return buffering_frames + render_ahead_frames;
+    }
+    static LatencyModel compute(int ksmps, int host_span_frames, int render_ahead_blocks, bool direct_rendering)
+    {
+        LatencyModel latency_model;
+        latency_model.ksmps = ksmps;
+        if (direct_rendering == false)
+        {
+            latency_model.buffering_frames = ksmps;
+        }
+        if (direct_rendering == false && render_ahead_blocks > 0)
+        {
+            auto render_ahead_ksmps = (render_ahead_blocks * host_span_frames + ksmps - 1) / ksmps;
+            latency_model.render_ahead_frames = render_ahead_ksmps * ksmps;
+        }
+        return latency_model;
+    }
+};
+
+class CsoundVST3AudioProcessor;
+
+/**
+ * A Csound instance that has been compiled in the background, with the
+ * pointers of every channel that CsoundVST3 binds in it, ready to be
+ * swapped in for the running instance at a ksmps block boundary. After the
+ * swap, the same object holds the instance that was swapped out, and its
+ * pointers, while it fades out and until CompileThread destroys it.
+ */
+class HotSwap
+{
+public:
+    std::unique_ptr<Csound> csound;
+    std::unique_ptr<ChannelTable> channel_table;
+    std::vector<ControllerBinding> controller_bindings;
+    std::array<int16_t, 16 * 128> controller_binding_indexes;
+    std::array<MYFLT *, 17> mpe_pitch_bend_channels{};
+    std::array<MYFLT *, 17> mpe_pressure_channels{};
+    std::array<MYFLT *, 17> mpe_timbre_channels{};
+    MYFLT *active_instances_channel = nullptr;
+    std::array<MYFLT *, ParameterBank::capacity> parameter_channels{};
+    std::array<const MYFLT *, OutputBank::capacity> output_channels{};
+};
+
+/**
+ * Compiles csds for hot swapping into new Csound instances, and destroys
+ * the instances that have been swapped out, so that neither the message
+ * thread nor the audio thread ever waits for Csound to compile or clean up.
+ */
+class CompileThread : public juce::Thread
+{
+public:
+    CompileThread(CsoundVST3AudioProcessor &processor_);
+    void run() override;
+private:
+    CsoundVST3AudioProcessor &processor;
+};
+
+/**
+ * Runs Csound on its own high-priority thread, rendering ahead of the host
+ * into the processor's audio rings, in the manner of
+ * CsoundThreaded::PerformRoutine. processBlock then only copies to and from
+ * the rings, and wakes this thread after taking each span of output.
+ */
+class RenderAheadThread : public juce::Thread
+{
+public:
+    RenderAheadThread(CsoundVST3AudioProcessor &processor_);
+    void run() override;
+private:
+    CsoundVST3AudioProcessor &processor;
 };
 
-class CsoundVST3AudioProcessor : public juce::AudioProcessor, public juce::ChangeBroadcaster
+class CsoundVST3AudioProcessor : public juce::AudioProcessor, public juce::ChangeBroadcaster, private juce::Timer
 {
 public:
     //==============================================================================
@@ -49,7 +252,11 @@ public:
     void releaseResources() override;
 
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
+    bool canAddBus (bool isInput) const override;
+    bool canRemoveBus (bool isInput) const override;
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock (juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override;
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
@@ -76,6 +283,8 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
     static void csoundMessageCallback_(CSOUND *, int, const char *, va_list);
     void csoundMessage(const juce::String message);
+    void csoundMessage(const char *message);
+    MessageQueues::Producer messageProducer() const;
     
     static int midiDeviceOpen(CSOUND *csound, void **userData,
                               const char *devName);
@@ -86,14 +295,59 @@ public:
     
     void play();
     void stop();
+    bool performBufferedBlocks();
+    int performKsmps();
+    bool applyTransportEvents();
+    void takeMidiEvents();
+    bool scheduleNote(const MidiEvent &midi_event);
+    void queueNote(const MidiEvent &midi_event, MYFLT instrument, bool note_on, int key, int velocity, int mpe_channel);
+    void bindControllers(const CsoundVST3Options &options, Csound &instance, const ChannelTable &table, std::vector<ControllerBinding> &bindings, std::array<int16_t, 16 * 128> &binding_indexes);
+    bool writeBoundController(const MidiEvent &midi_event);
+    void markSupersededControllers(const juce::MidiBuffer &host_midi_buffer);
+    void bindMpeChannels(const CsoundVST3Options &options);
+    void findMpeChannels(const CsoundVST3Options &options, Csound &instance, const ChannelTable &table, std::array<MYFLT *, 17> &pitch_bend_channels, std::array<MYFLT *, 17> &pressure_channels, std::array<MYFLT *, 17> &timbre_channels);
+    bool handleMpe(const MidiEvent &midi_event);
+    void startRenderAheadThread();
+    void updateLatency();
+    juce::String getLatencyStatus() const;
+    juce::String getOutputStatus() const;
+    void configureCsound(Csound &instance, const CsoundVST3Options &options);
+    bool compileInstance(const juce::String &csd_, const CsoundVST3Options &options, HotSwap &instance);
+    void exchangeInstance(HotSwap &instance);
+    bool requestHotSwap();
+    bool requestEvaluation(const juce::String &csd_, const juce::String &selection);
+    void restart();
+    void compileHotSwaps();
+    void evaluateInstruments();
+    bool compileHotSwap(const juce::String &csd_, HotSwap &swap);
+    void beginHotSwap(HotSwap *swap);
+    void crossfadeHotSwap();
+    void destroyHotSwap(HotSwap *swap);
+    void startCompileThread();
+    void stopCompileThread();
+    void stopRenderAheadThread();
+    template<typename Sample>
+    void renderBlock(juce::AudioBuffer<Sample> &host_audio_buffer, juce::MidiBuffer &host_midi_buffer);
+    template<typename Sample>
+    void renderDirect(juce::AudioBuffer<Sample> &host_audio_buffer);
+    template<typename Sample>
+    void renderBuffered(juce::AudioBuffer<Sample> &host_audio_buffer);
+    template<typename Sample>
+    void clearUnmappedOutputs(juce::AudioBuffer<Sample> &host_audio_buffer);
+    void buildChannelMaps();
+    void fallBackToBufferedRendering();
 
-    Csound csound;
+    std::unique_ptr<Csound> csound;
     std::atomic<bool> csoundIsPlaying = false;
+    // Held by render_ahead_thread while it renders, and by processBlock when
+    // it renders offline in its place.
+    juce::CriticalSection render_ahead_lock;
     std::function<void(const juce::String&)> messageCallback;
     juce::String csd;
     juce::PluginHostType plugin_host_type;
 
 private:
+    void timerCallback() override;
     /**
      * Amplitude corresponding to zero decibels full scale.
      */
@@ -126,21 +380,178 @@ private:
     // performance.
     int64_t csound_block_begin;
     int64_t csound_block_end;
+    // Where Csound blocks begin: csound_block_begin is always this plus a
+    // whole number of ksmps blocks.
+    int64_t csound_block_origin;
     int64_t host_block_begin;
     int64_t host_block_end;
     int64_t midi_input_sequence;
 
     // These intermediate FIFOs simplify synchronizing overlapping or 
-    // incomplete blocks of sample frames.
-    moodycamel::ReaderWriterQueue<MidiChannelMessage> midi_input_fifo;
-    moodycamel::ReaderWriterQueue<double> audio_input_fifo;
-    moodycamel::ReaderWriterQueue<MidiChannelMessage> midi_output_fifo;
-    moodycamel::ReaderWriterQueue<double> audio_output_fifo;
+    // incomplete blocks of sample frames. The audio rings hold interleaved
+    // frames in Csound's own layout and are sized in prepareToPlay.
+    moodycamel::ReaderWriterQueue<MidiEvent> midi_input_fifo;
+    SysexArena midi_input_arena;
+    FrameRingBuffer<MYFLT> audio_input_ring;
+    moodycamel::ReaderWriterQueue<MidiEvent> midi_output_fifo;
+    SysexArena midi_output_arena;
+    // Receives each long output message in one piece for the host.
+    std::vector<uint8_t> midi_output_long_message;
+    FrameRingBuffer<MYFLT> audio_output_ring;
+    // The largest number of host frames moved through the rings at once.
+    int host_span_frames;
+    // True while every host block is a whole number of ksmps blocks, so
+    // that Csound can render straight into the host's buffer with no FIFOs
+    // and no latency. Set in prepareToPlay, cleared by the first odd-sized
+    // host block.
+    bool direct_rendering;
+    // Frames of silence pushed onto audio_input_ring before performance,
+    // so that a full ksmps of input is always available to Csound. This is
+    // latency_model.getPrefillFrames().
+    int audio_input_prefill_frames;
+    LatencyModel latency_model;
+    // The latency last reported to the host, and the latency actually found
+    // in the audio rings at the end of the last host block.
+    std::atomic<int> reported_latency_frames;
+    std::atomic<int> measured_latency_frames;
+    // If greater than zero, the number of host blocks that
+    // render_ahead_thread renders ahead of the host.
+    int render_ahead_blocks;
+    std::unique_ptr<RenderAheadThread> render_ahead_thread;
+    // Hot swap: when Csound is playing, Play hands the csd to
+    // compile_thread, which compiles it into a new instance and passes it
+    // in pending_swap to the thread that runs Csound. That thread swaps it
+    // in at the next ksmps block, and crossfades from the old instance,
+    // kept in fading_swap, over hot_swap_crossfade_frames. The old instance
+    // then goes back through retired_swaps to be destroyed. compile_csd and
+    // compile_requested are guarded by compile_lock.
+    int hot_swap_crossfade_frames;
+    juce::String hot_swap_options;
+    std::unique_ptr<CompileThread> compile_thread;
+    juce::CriticalSection compile_lock;
+    juce::String compile_csd;
+    bool compile_requested;
+    // Evaluate: the editor hands the csd, or a selection of it, to
+    // compile_thread, which compiles the changed instruments into
+    // live_csound, the newest instance, whose orchestra is live_orchestra.
+    // The evaluate_ fields are guarded by compile_lock, and the live_
+    // fields belong to compile_thread.
+    juce::String evaluate_csd;
+    juce::String evaluate_selection;
+    bool evaluate_requested;
+    Csound *live_csound;
+    OrchestraBlocks live_orchestra;
+    std::atomic<HotSwap *> pending_swap{nullptr};
+    std::unique_ptr<HotSwap> fading_swap;
+    int crossfade_frames_done;
+    moodycamel::ReaderWriterQueue<HotSwap *> retired_swaps;
+    std::atomic<bool> hot_swap_restart_pending;
+    // Set by the audio thread after falling back to buffered rendering, so
+    // that the message thread reports the new latency.
+    std::atomic<bool> buffered_latency_pending;
+    // Counts host spans that render_ahead_thread did not render in time.
+    std::atomic<int64_t> render_ahead_underruns;
+    // Counts host spans that did not fit in audio_input_ring.
+    std::atomic<int64_t> audio_input_overruns;
+    moodycamel::ReaderWriterQueue<TransportEvent> transport_fifo;
+    // Transport events that did not fit in a full FIFO, which is never grown.
+    std::atomic<int64_t> transport_events_dropped;
+    // MIDI events that did not fit in a full FIFO, which is never grown.
+    std::atomic<int64_t> midi_events_dropped;
+    // If true, note on and note off messages become score events.
+    bool sample_accurate_notes;
+    // For each MIDI channel, the instrument that its notes play when
+    // sample_accurate_notes is true.
+    std::array<int, 17> note_instruments;
+    // The score statements for the notes of the current Csound block, sent
+    // to Csound as one line event by performKsmps. Sized in prepareToPlay,
+    // never grown; note_events_size excludes the terminating null.
+    std::vector<char> note_events;
+    size_t note_events_size;
+    // Notes that did not fit in note_events.
+    std::atomic<int64_t> note_events_dropped;
+    // The MIDI events for the current Csound block, taken from
+    // midi_input_fifo by performKsmps and delivered by midiRead. Reserved
+    // in prepareToPlay, never grown.
+    std::vector<MidiEvent> midi_block_events;
+    size_t midi_block_events_read;
+    // Control changes bound to Csound control channels, and for each MIDI
+    // channel and controller, the index of its binding or -1. Built in
+    // prepareToPlay.
+    std::vector<ControllerBinding> controller_bindings;
+    std::array<int16_t, 16 * 128> controller_binding_indexes;
+    // Control change coalescing: for each MIDI channel and controller, the
+    // sequence number and Csound block of its newest control change, and
+    // for each event of the host block, whether a newer control change
+    // supersedes it. midi_superseded is sized in prepareToPlay.
+    bool coalesce_controllers;
+    std::array<int64_t, 16 * 128> controller_last_sequence;
+    std::array<int64_t, 16 * 128> controller_last_block;
+    std::vector<uint8_t> midi_superseded;
+    // Counts control changes that were not sent because a newer value of
+    // the same controller superseded them.
+    std::atomic<int64_t> midi_controllers_merged;
+    // MPE: notes on member channels play mpe_instrument, and per-note
+    // pitch bend (in semitones), pressure and timbre (0 to 1) go to these
+    // control channels, indexed by MIDI channel, 1 to 16.
+    MpeZones mpe_zones;
+    int mpe_instrument;
+    MYFLT mpe_bend_range;
+    MYFLT mpe_master_bend_range;
+    std::array<MYFLT *, 17> mpe_pitch_bend_channels;
+    std::array<MYFLT *, 17> mpe_pressure_channels;
+    std::array<MYFLT *, 17> mpe_timbre_channels;
+    // The orchestra's channels and their value pointers, listed after each
+    // compile, and read only when binding, never during performance.
+    std::unique_ptr<ChannelTable> current_channel_table;
+    // Host parameters bound to the orchestra's chn_k and chn_a input
+    // channels.
+    ParameterBank parameter_bank;
+    // Read-only host parameters that follow the orchestra's chn_k output
+    // channels, sampled once per host block.
+    OutputBank output_bank;
+    // Counts, per Csound block, the events carried over to a later block
+    // because Csound did not read them or the staging array was full.
+    std::atomic<int64_t> midi_events_deferred;
+    // Numbers MIDI output events, on the thread that runs Csound.
+    int64_t midi_output_sequence;
+    // Counts MIDI output events sent to the host after their frame.
+    std::atomic<int64_t> midi_output_late;
+    // Converts between the host's planar buffers and Csound's interleaved
+    // spin and spout, using the fastest instructions this CPU has.
+    const SampleKernels *sample_kernels;
+    // Map Csound's spin and spout channels to the host's bus channels, and
+    // list the host channels that no Csound channel writes. Built in
+    // prepareToPlay.
+    ChannelMap input_channel_map;
+    ChannelMap output_channel_map;
+    std::vector<int> unmapped_output_channels;
+    // Idle mode: after idle_after_frames of silence with no active
+    // instances, performKsmps skips Csound until an event or sound arrives.
+    // active_instances_channel is written by an injected monitor instrument.
+    int64_t idle_after_frames;
+    int64_t silent_frames;
+    std::atomic<bool> idle;
+    std::atomic<int64_t> idle_blocks;
+    MYFLT *active_instances_channel;
+    double tail_seconds;
+    // True if Csound was compiled for offline rendering: no render-ahead
+    // thread, and possibly an offline ksmps. If the host returns to realtime
+    // without calling prepareToPlay, realtime_restart_pending makes the
+    // message thread call it.
+    bool offline_rendering;
+    bool offline_ksmps_applied;
+    std::atomic<bool> realtime_restart_pending;
 public:
     /**
      * Enables efficient asynchronous updating of the Csound message display.
+     * Each thread that writes messages has its own queue, which it is
+     * told apart by with these thread IDs.
      */
-    moodycamel::ReaderWriterQueue<juce::String> csound_messages_fifo;
+    MessageQueues csound_messages;
+    std::atomic<juce::Thread::ThreadID> audio_thread_id{nullptr};
+    std::atomic<juce::Thread::ThreadID> render_ahead_thread_id{nullptr};
+    std::atomic<juce::Thread::ThreadID> compile_thread_id{nullptr};
 
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CsoundVST3AudioProcessor)
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Maps each of Csound's spin or spout channels to a channel of the host's
+ * process buffer, or to nothing. The map is built once, bus by bus, in
+ * prepareToPlay; after that, getChannels only gathers channel pointers, once
+ * per block or span, and never allocates.
+ *
+ * Csound channels with no host channel are read from a silent scratch
+ * channel (inputs), or written to a scratch channel that nobody reads
+ * (outputs), so that the sample kernels always see exactly as many planar
+ * channels as Csound has, and never need to branch on a missing channel.
+ */
+class ChannelMap
+{
+public:
+    /**
+     * Maps all Csound channels to nothing, and allocates scratch channels
+     * for blocks of up to max_frames. Not thread-safe.
+     */
+    void resize(int csound_channels_, int max_frames_)
+    {
+        host_channels.assign(size_t(std::max(csound_channels_, 0)), -1);
+        max_frames = std::max(max_frames_, 1);
+        float_scratch.assign(size_t(max_frames), 0.f);
+        double_scratch.assign(size_t(max_frames), 0.);
+        float_pointers.assign(host_channels.size(), nullptr);
+        double_pointers.assign(host_channels.size(), nullptr);
+    }
+    /**
+     * Maps the Csound channel to the host buffer channel. Not thread-safe.
+     */
+    void set(int csound_channel, int host_channel)
+    {
+        if (csound_channel >= 0 && csound_channel < size())
+        {
+            host_channels[size_t(csound_channel)] = host_channel;
+        }
+    }
+    /**
+     * Maps count consecutive Csound channels, beginning at csound_channel,
+     * to consecutive host channels beginning at host_channel, which may be
+     * -1 to map them to nothing. Returns the next unmapped Csound channel.
+     */
+    int setRange(int csound_channel, int host_channel, int count)
+    {
+        for (int channel = 0; channel < count; ++channel)
+        {
+            set(csound_channel + channel, host_channel < 0 ? -1 : host_channel + channel);
+        }
+        return csound_channel + count;
+    }
+    /**
+     * Returns the number of Csound channels.
+     */
+    int size() const
+    {
+        return int(host_channels.size());
+    }
+    /**
+     * Returns the host channel for the Csound channel, or -1.
+     */
+    int getHostChannel(int csound_channel) const
+    {
+        return host_channels[size_t(csound_channel)];
+    }
+    /**
+     * Returns true if some Csound channel maps to the host channel.
+     */
+    bool isMapped(int host_channel) const
+    {
+        return std::find(host_channels.begin(), host_channels.end(), host_channel) != host_channels.end();
+    }
+    /**
+     * Returns one pointer per Csound channel into the host buffer, beginning
+     * at frame offset, for at most max_frames frames. Unmapped channels, and
+     * host channels that the buffer does not have, point to scratch.
+     */
+    template<typename Sample>
+    Sample* const* getChannels(juce::AudioBuffer<Sample> &buffer, int offset)
+    {
+        auto pointers = storage(static_cast<Sample *>(nullptr));
+        auto scratch = scratchChannel(static_cast<Sample *>(nullptr));
+        auto buffer_pointers = buffer.getArrayOfWritePointers();
+        const int buffer_channels = buffer.getNumChannels();
+        for (size_t channel = 0; channel < host_channels.size(); ++channel)
+        {
+            const int host_channel = host_channels[channel];
+            if (host_channel >= 0 && host_channel < buffer_channels)
+            {
+                pointers[channel] = buffer_pointers[host_channel] + offset;
+            }
+            else
+            {
+                pointers[channel] = scratch;
+            }
+        }
+        return pointers;
+    }
+private:
+    float **storage(float *)
+    {
+        return float_pointers.data();
+    }
+    double **storage(double *)
+    {
+        return double_pointers.data();
+    }
+    float *scratchChannel(float *)
+    {
+        return float_scratch.data();
+    }
+    double *scratchChannel(double *)
+    {
+        return double_scratch.data();
+    }
+    std::vector<int> host_channels;
+    int max_frames = 1;
+    std::vector<float> float_scratch;
+    std::vector<double> double_scratch;
+    std::vector<float *> float_pointers;
+    std::vector<double *> double_pointers;
+};
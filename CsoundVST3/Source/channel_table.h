@@ -0,0 +1,123 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include "csound.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+/**
+ * The named channels of a compiled orchestra, i.e. those declared with
+ * chn_k, chn_a or chnexport, or otherwise created by its global code, as
+ * listed once by csoundListChannels after Csound starts. Each channel's
+ * value pointer is looked up when the table is built, so that parameters,
+ * meters and MIDI mappings bind to channels by direct pointer, and nothing
+ * ever looks up a channel by name during performance.
+ *
+ * A table is immutable once built. The processor builds a new one after
+ * every compile, and binds from it only while Csound is not performing;
+ * during performance, only the pointers that were bound are used. A table
+ * lives as long as the instance that it was built from, since its pointers
+ * point into that instance.
+ */
+class ChannelTable
+{
+public:
+    struct Entry
+    {
+        juce::String name;
+        // CSOUND_CONTROL_CHANNEL, CSOUND_AUDIO_CHANNEL, etc.
+        int type = 0;
+        // CSOUND_INPUT_CHANNEL and/or CSOUND_OUTPUT_CHANNEL.
+        int mode = 0;
+        MYFLT *pointer = nullptr;
+        // The range and default from the declaration's hints, if any, or
+        // else [0, 1] and 0.
+        bool has_hints = false;
+        double minimum = 0;
+        double maximum = 1;
+        double default_value = 0;
+    };
+    /**
+     * Lists the channels of the running orchestra. Call on the thread that
+     * compiles Csound, before Csound performs.
+     */
+    static std::unique_ptr<ChannelTable> build(CSOUND *csound)
+    {
+        auto table = std::make_unique<ChannelTable>();
+        controlChannelInfo_t *channels = nullptr;
+        const int count = csoundListChannels(csound, &channels);
+        if (count <= 0 || channels == nullptr)
+        {
+            return table;
+        }
+        table->entries.reserve(size_t(count));
+        for (int index = 0; index < count; ++index)
+        {
+            const auto &channel = channels[index];
+            Entry entry;
+            entry.name = juce::String::fromUTF8(channel.name);
+            entry.type = channel.type & CSOUND_CHANNEL_TYPE_MASK;
+            entry.mode = channel.type & (CSOUND_INPUT_CHANNEL | CSOUND_OUTPUT_CHANNEL);
+            csoundGetChannelPtr(csound, &entry.pointer, channel.name, channel.type);
+            if (entry.type == CSOUND_CONTROL_CHANNEL && channel.hints.behav != CSOUND_CONTROL_CHANNEL_NO_HINTS)
+            {
+                entry.has_hints = true;
+                entry.minimum = double(channel.hints.min);
+                entry.maximum = double(channel.hints.max);
+                entry.default_value = double(channel.hints.dflt);
+            }
+            if (entry.pointer != nullptr)
+            {
+                table->entries.push_back(entry);
+            }
+        }
+        csoundDeleteChannelList(csound, channels);
+        std::sort(table->entries.begin(), table->entries.end(), [](const Entry &a, const Entry &b)
+        {
+            return a.name < b.name;
+        });
+        return table;
+    }
+    /**
+     * Returns the channel with this name, or null.
+     */
+    const Entry *find(const juce::String &name) const
+    {
+        auto found = std::lower_bound(entries.begin(), entries.end(), name, [](const Entry &entry, const juce::String &name_)
+        {
+            return entry.name < name_;
+        });
+        if (found == entries.end() || found->name != name)
+        {
+            return nullptr;
+        }
+        return &*found;
+    }
+    /**
+     * Returns the value pointer of the channel, from the table if the
+     * orchestra has the channel with this type, or else by creating it in
+     * Csound. Call only where csoundGetChannelPtr may be called.
+     */
+    MYFLT *getChannelPtr(CSOUND *csound, const juce::String &name, int type) const
+    {
+        auto entry = find(name);
+        if (entry != nullptr && entry->type == (type & CSOUND_CHANNEL_TYPE_MASK))
+        {
+            return entry->pointer;
+        }
+        MYFLT *pointer = nullptr;
+        csoundGetChannelPtr(csound, &pointer, name.toRawUTF8(), type);
+        return pointer;
+    }
+    /**
+     * Returns all the channels, sorted by name.
+     */
+    const std::vector<Entry> &getEntries() const
+    {
+        return entries;
+    }
+private:
+    std::vector<Entry> entries;
+};
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+/**
+ * Options for CsoundVST3 itself, as opposed to options for Csound. These are
+ * written in an optional <CsoundVST3> element of the csd, which must come
+ * before the closing </CsoundSynthesizer> tag, one "name = value" per line;
+ * ";" begins a comment. For example:
+ *
+ * <CsoundVST3>
+ * render_ahead_blocks = 2 ; Render 2 host blocks ahead on a worker thread.
+ * </CsoundVST3>
+ *
+ * The element is removed from the csd before Csound compiles it, so Csound
+ * never sees it.
+ */
+struct CsoundVST3Options
+{
+    /**
+     * If greater than zero, Csound runs on its own high-priority thread and
+     * renders this many host blocks ahead of the host.
+     */
+    int render_ahead_blocks = 0;
+    /**
+     * If greater than zero, Csound stops performing after this many seconds
+     * with no active instrument instances, silent input and output, and no
+     * pending MIDI, and resumes at the first block with an event or sound.
+     */
+    double idle_after_seconds = 0;
+    /**
+     * Reported to the host by getTailLengthSeconds. The default is long
+     * enough for the releases and reverbs of most orchestras; in idle mode,
+     * where Csound itself stops after idle_after_seconds of silence, the
+     * tail defaults to that time. "inf" makes the tail infinite, for
+     * instruments that ring indefinitely, but then some hosts never suspend
+     * the plugin or end a bounce.
+     */
+    static constexpr double default_tail_seconds = 10;
+    double tail_seconds = default_tail_seconds;
+    /**
+     * If greater than zero, replaces the csd's ksmps when the host renders
+     * offline, where there is no deadline; e.g. 1 for sample-accurate
+     * control signals in bounces.
+     */
+    int offline_ksmps = 0;
+    /**
+     * If true, MIDI note on and note off messages are sent to Csound as
+     * score events at their exact frames, instead of as MIDI at the start
+     * of the Csound block.
+     */
+    bool sample_accurate_notes = false;
+    /**
+     * The instruments that notes play when sample_accurate_notes is true,
+     * written as "note_instrument = channel, instrument", where a channel
+     * of 0 means all channels. Other channels play the instrument of the
+     * same number, as in Csound's default MIDI mapping; massign does not
+     * apply, since these notes never reach Csound's MIDI input.
+     */
+    std::vector<std::pair<int, int>> note_instruments;
+    /**
+     * If true, of the control changes for the same controller on the same
+     * channel within one Csound block, only the newest is sent to Csound.
+     */
+    bool coalesce_cc = false;
+    /**
+     * The time in milliseconds that host parameters take to ramp to a new
+     * value. JUCE gives the plugin each parameter's latest value, not the
+     * frames of the host's changes, so without a ramp, automation steps
+     * once per block; the default ramp is about one host block long.
+     */
+    double parameter_smoothing_ms = 10;
+    /**
+     * The time in milliseconds of the crossfade from the running Csound to
+     * a newly compiled one when Play is pressed during performance. If 0,
+     * the default, Csound is restarted instead, as it always was.
+     */
+    double hot_swap_crossfade_ms = 0;
+    /**
+     * Maps a MIDI control change straight to a Csound control channel,
+     * bypassing Csound's MIDI input. Written in the element as
+     * "cc = channel, controller, name[, minimum, maximum]", where a channel
+     * of 0 means all channels, and the controller's 0 to 127 is scaled to
+     * [minimum, maximum], by default [0, 1].
+     */
+    struct ControllerMapping
+    {
+        int channel = 0;
+        int controller = 0;
+        juce::String name;
+        double minimum = 0;
+        double maximum = 1;
+    };
+    std::vector<ControllerMapping> controller_mappings;
+    /**
+     * If greater than zero, MPE notes on member channels play this
+     * instrument, with per-note expression in per-channel control channels.
+     */
+    int mpe_instrument = 0;
+    /**
+     * Pitch bend ranges in semitones for MPE member and master channels.
+     */
+    double mpe_bend_range = 48;
+    double mpe_master_bend_range = 2;
+    /**
+     * Every "name = value" line in the element, in order. Names may repeat.
+     */
+    std::vector<std::pair<juce::String, juce::String>> lines;
+
+    static CsoundVST3Options parse(const juce::String &csd)
+    {
+        CsoundVST3Options options;
+        auto lines = juce::StringArray::fromLines(element(csd));
+        for (auto line : lines)
+        {
+            line = line.upToFirstOccurrenceOf(";", false, false).trim();
+            if (line.isEmpty() || line.containsChar('=') == false)
+            {
+                continue;
+            }
+            auto name = line.upToFirstOccurrenceOf("=", false, false).trim();
+            auto value = line.fromFirstOccurrenceOf("=", false, false).trim().unquoted();
+            options.lines.emplace_back(name, value);
+        }
+        options.render_ahead_blocks = juce::jlimit(0, 16, options.getInt("render_ahead_blocks", 0));
+        options.idle_after_seconds = std::max(0., options.getDouble("idle_after_seconds", 0.));
+        if (options.idle_after_seconds > 0)
+        {
+            options.tail_seconds = options.idle_after_seconds;
+        }
+        auto tail_seconds = options.get("tail_seconds");
+        if (tail_seconds.equalsIgnoreCase("inf") || tail_seconds.equalsIgnoreCase("infinite"))
+        {
+            options.tail_seconds = std::numeric_limits<double>::infinity();
+        }
+        else
+        {
+            options.tail_seconds = std::max(0., options.getDouble("tail_seconds", options.tail_seconds));
+        }
+        options.offline_ksmps = std::max(0, options.getInt("offline_ksmps", 0));
+        options.sample_accurate_notes = options.getBool("sample_accurate_notes", false);
+        options.coalesce_cc = options.getBool("coalesce_cc", false);
+        options.parameter_smoothing_ms = std::max(0., options.getDouble("parameter_smoothing_ms", options.parameter_smoothing_ms));
+        options.hot_swap_crossfade_ms = std::max(0., options.getDouble("hot_swap_crossfade_ms", options.hot_swap_crossfade_ms));
+        options.mpe_instrument = std::max(0, options.getInt("mpe_instrument", 0));
+        options.mpe_bend_range = options.getDouble("mpe_bend_range", options.mpe_bend_range);
+        options.mpe_master_bend_range = options.getDouble("mpe_master_bend_range", options.mpe_master_bend_range);
+        for (const auto &value : options.getAll("note_instrument"))
+        {
+            auto fields = juce::StringArray::fromTokens(value, ",", "\"");
+            fields.trim();
+            if (fields.size() < 2)
+            {
+                continue;
+            }
+            options.note_instruments.emplace_back(juce::jlimit(0, 16, fields[0].getIntValue()), std::max(1, fields[1].getIntValue()));
+        }
+        for (const auto &value : options.getAll("cc"))
+        {
+            auto fields = juce::StringArray::fromTokens(value, ",", "\"");
+            fields.trim();
+            if (fields.size() < 3)
+            {
+                continue;
+            }
+            ControllerMapping mapping;
+            mapping.channel = juce::jlimit(0, 16, fields[0].getIntValue());
+            mapping.controller = juce::jlimit(0, 127, fields[1].getIntValue());
+            mapping.name = fields[2].unquoted();
+            if (fields.size() >= 5)
+            {
+                mapping.minimum = fields[3].getDoubleValue();
+                mapping.maximum = fields[4].getDoubleValue();
+            }
+            options.controller_mappings.push_back(mapping);
+        }
+        return options;
+    }
+    /**
+     * Returns the csd without its <CsoundVST3> element.
+     */
+    static juce::String strip(const juce::String &csd)
+    {
+        auto begin = csd.indexOf(begin_tag);
+        if (begin == -1)
+        {
+            return csd;
+        }
+        auto end = csd.indexOf(begin, end_tag);
+        if (end == -1)
+        {
+            return csd;
+        }
+        return csd.substring(0, begin) + csd.substring(end + juce::String(end_tag).length());
+    }
+    /**
+     * Returns the value of the last line with this name, or the default.
+     */
+    juce::String get(const juce::String &name, const juce::String &default_value = {}) const
+    {
+        for (auto it = lines.rbegin(); it != lines.rend(); ++it)
+        {
+            if (it->first == name)
+            {
+                return it->second;
+            }
+        }
+        return default_value;
+    }
+    /**
+     * Returns the values of all lines with this name, in order.
+     */
+    juce::StringArray getAll(const juce::String &name) const
+    {
+        juce::StringArray values;
+        for (const auto &line : lines)
+        {
+            if (line.first == name)
+            {
+                values.add(line.second);
+            }
+        }
+        return values;
+    }
+    int getInt(const juce::String &name, int default_value) const
+    {
+        auto value = get(name);
+        return value.isEmpty() ? default_value : value.getIntValue();
+    }
+    double getDouble(const juce::String &name, double default_value) const
+    {
+        auto value = get(name);
+        return value.isEmpty() ? default_value : value.getDoubleValue();
+    }
+    bool getBool(const juce::String &name, bool default_value) const
+    {
+        auto value = get(name);
+        if (value.isEmpty())
+        {
+            return default_value;
+        }
+        return value == "1" || value.equalsIgnoreCase("true") || value.equalsIgnoreCase("yes") || value.equalsIgnoreCase("on");
+    }
+    /**
+     * Returns the text of the csd's <CsoundVST3> element, or an empty
+     * string.
+     */
+    static juce::String element(const juce::String &csd)
+    {
+        auto begin = csd.indexOf(begin_tag);
+        if (begin == -1)
+        {
+            return {};
+        }
+        begin += juce::String(begin_tag).length();
+        auto end = csd.indexOf(begin, end_tag);
+        if (end == -1)
+        {
+            return {};
+        }
+        return csd.substring(begin, end);
+    }
+private:
+    static constexpr const char *begin_tag = "<CsoundVST3>";
+    static constexpr const char *end_tag = "</CsoundVST3>";
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * A lock-free, single-producer, single-consumer ring buffer of interleaved
+ * sample frames. Frames are laid out [frame][channel], exactly like
+ * Csound's spin and spout buffers, so that a whole ksmps block can be moved
+ * in or out with at most two memcpy calls.
+ *
+ * All storage is allocated by resize(), which must only be called when
+ * neither the producer nor the consumer is running (i.e. in prepareToPlay).
+ * After that, reading and writing never allocate, never lock, and never
+ * loop per sample.
+ */
+template<typename Sample>
+class FrameRingBuffer
+{
+public:
+    /**
+     * A contiguous run of frames inside the ring. A request for frames may
+     * wrap around the end of the storage, so it is returned as two spans,
+     * the second of which is empty unless the request wrapped.
+     */
+    struct Span
+    {
+        Sample *data = nullptr;
+        int frames = 0;
+    };
+    struct Spans
+    {
+        Span first;
+        Span second;
+    };
+    /**
+     * Allocates storage for the indicated number of interleaved channels
+     * and frames, and empties the ring. Not thread-safe.
+     */
+    void resize(int channels_, int capacity_frames_)
+    {
+        channel_count = std::max(channels_, 0);
+        capacity_frames = std::max(capacity_frames_, 1);
+        storage.assign(size_t(channel_count) * size_t(capacity_frames), Sample(0));
+        clear();
+    }
+    /**
+     * Empties the ring. Not thread-safe.
+     */
+    void clear()
+    {
+        write_count.store(0, std::memory_order_relaxed);
+        read_count.store(0, std::memory_order_relaxed);
+    }
+    int channels() const
+    {
+        return channel_count;
+    }
+    int capacity() const
+    {
+        return capacity_frames;
+    }
+    /**
+     * Returns the number of frames that the consumer may read.
+     */
+    int readable() const
+    {
+        auto written = write_count.load(std::memory_order_acquire);
+        auto read = read_count.load(std::memory_order_relaxed);
+        return int(written - read);
+    }
+    /**
+     * Returns the number of frames that the producer may write.
+     */
+    int writable() const
+    {
+        auto written = write_count.load(std::memory_order_relaxed);
+        auto read = read_count.load(std::memory_order_acquire);
+        return capacity_frames - int(written - read);
+    }
+    /**
+     * Producer: returns writable spans for up to the requested number of
+     * frames, for in-place conversion into the ring. Call commitWrite with
+     * the number of frames actually written.
+     */
+    Spans writeSpans(int frames)
+    {
+        frames = std::min(frames, writable());
+        return spansAt(write_count.load(std::memory_order_relaxed), frames);
+    }
+    void commitWrite(int frames)
+    {
+        write_count.store(write_count.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+    }
+    /**
+     * Consumer: returns readable spans for up to the requested number of
+     * frames, for in-place conversion out of the ring. Call commitRead with
+     * the number of frames actually consumed.
+     */
+    Spans readSpans(int frames)
+    {
+        frames = std::min(frames, readable());
+        return spansAt(read_count.load(std::memory_order_relaxed), frames);
+    }
+    void commitRead(int frames)
+    {
+        read_count.store(read_count.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+    }
+    /**
+     * Producer: copies up to the requested number of interleaved frames
+     * into the ring, and returns the number of frames copied.
+     */
+    int write(const Sample *source, int frames)
+    {
+        auto spans = writeSpans(frames);
+        copyFrames(spans.first.data, source, spans.first.frames);
+        copyFrames(spans.second.data, source + size_t(spans.first.frames) * channel_count, spans.second.frames);
+        auto written = spans.first.frames + spans.second.frames;
+        commitWrite(written);
+        return written;
+    }
+    /**
+     * Producer: writes up to the requested number of frames of silence, and
+     * returns the number of frames written.
+     */
+    int writeSilence(int frames)
+    {
+        auto spans = writeSpans(frames);
+        zeroFrames(spans.first.data, spans.first.frames);
+        zeroFrames(spans.second.data, spans.second.frames);
+        auto written = spans.first.frames + spans.second.frames;
+        commitWrite(written);
+        return written;
+    }
+    /**
+     * Consumer: copies up to the requested number of interleaved frames out
+     * of the ring, and returns the number of frames copied.
+     */
+    int read(Sample *destination, int frames)
+    {
+        auto spans = readSpans(frames);
+        copyFrames(destination, spans.first.data, spans.first.frames);
+        copyFrames(destination + size_t(spans.first.frames) * channel_count, spans.second.data, spans.second.frames);
+        auto consumed = spans.first.frames + spans.second.frames;
+        commitRead(consumed);
+        return consumed;
+    }
+private:
+    Spans spansAt(uint64_t count, int frames)
+    {
+        Spans spans;
+        if (frames <= 0)
+        {
+            return spans;
+        }
+        auto index = int(count % uint64_t(capacity_frames));
+        auto first_frames = std::min(frames, capacity_frames - index);
+        spans.first.data = storage.data() + size_t(index) * channel_count;
+        spans.first.frames = first_frames;
+        if (first_frames < frames)
+        {
+            spans.second.data = storage.data();
+            spans.second.frames = frames - first_frames;
+        }
+        return spans;
+    }
+    void copyFrames(Sample *destination, const Sample *source, int frames) const
+    {
+        if (frames > 0 && channel_count > 0)
+        {
+            std::memcpy(destination, source, size_t(frames) * channel_count * sizeof(Sample));
+        }
+    }
+    void zeroFrames(Sample *destination, int frames) const
+    {
+        if (frames > 0 && channel_count > 0)
+        {
+            std::memset(destination, 0, size_t(frames) * channel_count * sizeof(Sample));
+        }
+    }
+    std::vector<Sample> storage;
+    int channel_count = 0;
+    int capacity_frames = 1;
+    std::atomic<uint64_t> write_count{0};
+    std::atomic<uint64_t> read_count{0};
+};
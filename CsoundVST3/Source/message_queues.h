@@ -0,0 +1,178 @@
+#pragma once
+
+#include "readerwriterqueue.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+/**
+ * Csound messages on their way to the editor's message log. Messages come
+ * from every thread that runs Csound or talks to it: the message thread,
+ * the host's audio thread, the render-ahead thread, the compile thread,
+ * and any threads of Csound's own. A moodycamel::ReaderWriterQueue may
+ * have only one producer, so each of these threads has its own queue, and
+ * the message thread merges the queues back into order by sequence number.
+ *
+ * A message is split into fixed-size, trivially copyable records, like a
+ * MidiEvent, so that writing never allocates and never locks. A message
+ * that does not fit in its queue is dropped whole, and counted. Threads
+ * that are not known share one queue, which they take turns at with a
+ * try-lock; a message that would have to wait for it is dropped instead.
+ *
+ * All storage is allocated by the constructor.
+ */
+class MessageQueues
+{
+public:
+    enum Producer
+    {
+        message_thread,
+        audio_thread,
+        render_ahead_thread,
+        compile_thread,
+        other_thread,
+        producer_count
+    };
+    struct Record
+    {
+        // Numbers the records of all queues in the order they were written.
+        int64_t sequence;
+        uint16_t size;
+        // True if the next record in the same queue continues the message.
+        bool more;
+        char text[117];
+    };
+    static_assert(sizeof(Record) == 128);
+    explicit MessageQueues(size_t records_per_queue_) : records_per_queue(records_per_queue_)
+    {
+        for (auto &queue : queues)
+        {
+            queue = std::make_unique<Queue>(records_per_queue);
+        }
+    }
+    /**
+     * Producer: writes the whole message to the producer's queue, or drops
+     * it if there is no room. Returns false if the message was dropped.
+     */
+    bool write(Producer producer, const char *text)
+    {
+        if (producer != other_thread)
+        {
+            return enqueue(*queues[size_t(producer)], text);
+        }
+        if (other_lock.test_and_set(std::memory_order_acquire) == true)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        const auto result = enqueue(*queues[size_t(other_thread)], text);
+        other_lock.clear(std::memory_order_release);
+        return result;
+    }
+    /**
+     * Consumer, i.e. the message thread: appends every message that has
+     * been written to text, in the order the messages were written. A
+     * message whose last records are still being written is finished by
+     * the next call.
+     */
+    void read(std::string &text)
+    {
+        while (true)
+        {
+            if (continuing == nullptr)
+            {
+                const Record *first = nullptr;
+                for (auto &queue : queues)
+                {
+                    auto record = queue->peek();
+                    if (record != nullptr && (first == nullptr || record->sequence < first->sequence))
+                    {
+                        first = record;
+                        continuing = queue.get();
+                    }
+                }
+                if (continuing == nullptr)
+                {
+                    return;
+                }
+            }
+            while (auto record = continuing->peek())
+            {
+                text.append(record->text, record->size);
+                const bool more = record->more;
+                continuing->pop();
+                if (more == false)
+                {
+                    continuing = nullptr;
+                    break;
+                }
+            }
+            if (continuing != nullptr)
+            {
+                return;
+            }
+        }
+    }
+    /**
+     * Consumer: discards every message that has been written.
+     */
+    void clear()
+    {
+        Record record;
+        for (auto &queue : queues)
+        {
+            while (queue->try_dequeue(record))
+            {
+            }
+        }
+        continuing = nullptr;
+    }
+    /**
+     * Returns the number of messages dropped since the last call, and
+     * starts counting again.
+     */
+    int64_t takeDropped()
+    {
+        return dropped.exchange(0, std::memory_order_relaxed);
+    }
+private:
+    using Queue = moodycamel::ReaderWriterQueue<Record>;
+    bool enqueue(Queue &queue, const char *text)
+    {
+        const auto size = std::strlen(text);
+        const auto records = std::max(size_t(1), (size + sizeof(Record::text) - 1) / sizeof(Record::text));
+        // The queue always has room for records_per_queue records, and only
+        // this producer adds to it, so if there is room now, every record
+        // of the message fits, and the consumer never waits for the rest of
+        // a message that was cut short.
+        if (queue.size_approx() + records > records_per_queue)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        auto sequence = next_sequence.fetch_add(int64_t(records), std::memory_order_relaxed);
+        for (size_t index = 0; index < records; ++index)
+        {
+            Record record;
+            const auto offset = index * sizeof(Record::text);
+            record.sequence = sequence++;
+            record.size = uint16_t(std::min(size - offset, sizeof(Record::text)));
+            record.more = index + 1 < records;
+            std::memcpy(record.text, text + offset, record.size);
+            queue.try_enqueue(record);
+        }
+        return true;
+    }
+    const size_t records_per_queue;
+    std::array<std::unique_ptr<Queue>, producer_count> queues;
+    std::atomic<int64_t> next_sequence{0};
+    std::atomic<int64_t> dropped{0};
+    std::atomic_flag other_lock = ATOMIC_FLAG_INIT;
+    // Used only by the consumer: the queue whose message is being read.
+    Queue *continuing = nullptr;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+/**
+ * Tracks the MIDI Polyphonic Expression zones that a controller sets up
+ * with MPE Configuration Messages (registered parameter 6, sent on channel
+ * 1 for the lower zone, or on channel 16 for the upper zone). Channels are
+ * numbered from 1 to 16.
+ *
+ * Until a controller configures the zones, there is one lower zone with
+ * all 15 member channels, which is what most MPE controllers use.
+ */
+class MpeZones
+{
+public:
+    MpeZones()
+    {
+        reset();
+    }
+    void reset()
+    {
+        registered_parameter_msb.fill(127);
+        registered_parameter_lsb.fill(127);
+        setZones(15, 0);
+    }
+    /**
+     * Follows the registered parameter number on the channel, and applies
+     * an MPE Configuration Message when one is complete. Returns true if the
+     * zones changed.
+     */
+    bool handleControlChange(int channel, int controller, int value)
+    {
+        switch (controller)
+        {
+        case 101:
+            registered_parameter_msb[size_t(channel)] = uint8_t(value);
+            return false;
+        case 100:
+            registered_parameter_lsb[size_t(channel)] = uint8_t(value);
+            return false;
+        case 6:
+            if (registered_parameter_msb[size_t(channel)] != 0 || registered_parameter_lsb[size_t(channel)] != 6)
+            {
+                return false;
+            }
+            if (channel == 1)
+            {
+                setZones(value, std::min(upper_members, 14 - value));
+                return true;
+            }
+            if (channel == 16)
+            {
+                setZones(std::min(lower_members, 14 - value), value);
+                return true;
+            }
+            return false;
+        default:
+            return false;
+        }
+    }
+    bool isMemberChannel(int channel) const
+    {
+        return member_channels[size_t(channel)];
+    }
+    bool isMasterChannel(int channel) const
+    {
+        return (channel == 1 && lower_members > 0) || (channel == 16 && upper_members > 0);
+    }
+private:
+    void setZones(int lower_members_, int upper_members_)
+    {
+        lower_members = std::max(0, std::min(lower_members_, 15));
+        upper_members = std::max(0, std::min(upper_members_, 15 - lower_members));
+        member_channels.fill(false);
+        for (int channel = 2; channel < 2 + lower_members; ++channel)
+        {
+            member_channels[size_t(channel)] = true;
+        }
+        for (int channel = 15; channel > 15 - upper_members; --channel)
+        {
+            member_channels[size_t(channel)] = true;
+        }
+    }
+    int lower_members = 0;
+    int upper_members = 0;
+    std::array<bool, 17> member_channels{};
+    std::array<uint8_t, 17> registered_parameter_msb{};
+    std::array<uint8_t, 17> registered_parameter_lsb{};
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <vector>
+
+/**
+ * The orchestra of a csd, i.e. its <CsInstruments> element, split into its
+ * instr ... endin blocks and the global code between them. Used to find
+ * which instruments have been edited since the orchestra was compiled, so
+ * that only those need to be compiled again into the running Csound.
+ *
+ * A block begins with a line whose first word is "instr" and ends with a
+ * line whose first word is "endin". Blocks are compared as text, so that
+ * editing a comment inside an instrument also counts as a change.
+ */
+class OrchestraBlocks
+{
+public:
+    struct Block
+    {
+        // The rest of the instr line, e.g. "1" or "Reverb" or "1, 2".
+        juce::String name;
+        // The whole block, from the instr line through the endin line.
+        juce::String text;
+    };
+    /**
+     * What the Evaluate button compiles into the running Csound.
+     */
+    struct Evaluation
+    {
+        juce::String code;
+        // The names of the blocks in code, unless code is a selection.
+        juce::StringArray names;
+        // True if the global code differs from the base orchestra's, which
+        // is never evaluated, since that would reinitialize it.
+        bool global_code_changed = false;
+    };
+    static OrchestraBlocks parse(const juce::String &csd)
+    {
+        OrchestraBlocks orchestra;
+        auto begin = csd.indexOf("<CsInstruments>");
+        auto end = csd.indexOf("</CsInstruments>");
+        if (begin == -1 || end < begin)
+        {
+            return orchestra;
+        }
+        begin += juce::String("<CsInstruments>").length();
+        const auto lines = juce::StringArray::fromLines(csd.substring(begin, end));
+        Block *block = nullptr;
+        for (const auto &line : lines)
+        {
+            const auto words = firstWords(line);
+            if (block == nullptr && words.upToFirstOccurrenceOf(" ", false, false) == "instr")
+            {
+                orchestra.blocks.push_back({words.fromFirstOccurrenceOf(" ", false, false).trim(), {}});
+                block = &orchestra.blocks.back();
+            }
+            if (block != nullptr)
+            {
+                block->text << line << "\n";
+                if (words.upToFirstOccurrenceOf(" ", false, false) == "endin")
+                {
+                    block = nullptr;
+                }
+            }
+            else
+            {
+                orchestra.global_code << line << "\n";
+            }
+        }
+        // An unterminated block is not an instrument that Csound can compile.
+        if (block != nullptr)
+        {
+            orchestra.global_code << block->text;
+            orchestra.blocks.pop_back();
+        }
+        return orchestra;
+    }
+    /**
+     * Returns the text of the blocks that are new, or differ from the block
+     * with the same name in the base orchestra, and appends their names.
+     */
+    juce::String changedBlocks(const OrchestraBlocks &base, juce::StringArray &names) const
+    {
+        juce::String text;
+        for (const auto &block : blocks)
+        {
+            auto base_block = base.find(block.name);
+            if (base_block == nullptr || base_block->text != block.text)
+            {
+                text << block.text;
+                names.add(block.name);
+            }
+        }
+        return text;
+    }
+    /**
+     * Returns the selection, if it is not empty; or else the blocks of this
+     * orchestra that are new or have changed since the base orchestra was
+     * compiled, with their names. Blocks that are only in the base
+     * orchestra are not removed from Csound, and so are left out.
+     */
+    Evaluation evaluate(const OrchestraBlocks &base, const juce::String &selection) const
+    {
+        Evaluation evaluation;
+        if (selection.isNotEmpty())
+        {
+            evaluation.code = selection;
+            return evaluation;
+        }
+        evaluation.code = changedBlocks(base, evaluation.names);
+        evaluation.global_code_changed = global_code != base.global_code;
+        return evaluation;
+    }
+    /**
+     * Replaces or adds the blocks that were compiled from this orchestra in
+     * the base orchestra.
+     */
+    void mergeInto(OrchestraBlocks &base) const
+    {
+        for (const auto &block : blocks)
+        {
+            auto base_block = base.find(block.name);
+            if (base_block == nullptr)
+            {
+                base.blocks.push_back(block);
+            }
+            else
+            {
+                base_block->text = block.text;
+            }
+        }
+    }
+    const Block *find(const juce::String &name) const
+    {
+        for (const auto &block : blocks)
+        {
+            if (block.name == name)
+            {
+                return &block;
+            }
+        }
+        return nullptr;
+    }
+    Block *find(const juce::String &name)
+    {
+        return const_cast<Block *>(static_cast<const OrchestraBlocks &>(*this).find(name));
+    }
+    std::vector<Block> blocks;
+    juce::String global_code;
+private:
+    /**
+     * Returns the line without any ";" or "//" comment, with runs of white
+     * space collapsed to single spaces.
+     */
+    static juce::String firstWords(const juce::String &line)
+    {
+        auto code = line.upToFirstOccurrenceOf(";", false, false).upToFirstOccurrenceOf("//", false, false);
+        auto words = juce::StringArray::fromTokens(code, " \t", "\"");
+        words.removeEmptyStrings();
+        return words.joinIntoString(" ");
+    }
+};
@@ -0,0 +1,632 @@
+#pragma once
+
+#include <juce_audio_processors/juce_audio_processors.h>
+#include "channel_table.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * A host parameter that stands for one Csound control or audio channel. The
+ * host may set it from any thread; setValue only stores the normalized value
+ * and raises the parameter's dirty bit, and the thread that runs Csound
+ * writes the scaled value to the channel at the start of the next ksmps
+ * block, optionally as a linear ramp: per ksmps block for a control
+ * channel, and per sample for an audio channel.
+ *
+ * The parameter's ID never changes, so that host automation stays attached
+ * to it; its name and range are those of the channel it is bound to.
+ */
+class ChannelParameter : public juce::HostedAudioProcessorParameter
+{
+public:
+    ChannelParameter(int index_, std::atomic<uint64_t> &dirty_word_) :
+        index(index_),
+        dirty_word(dirty_word_),
+        dirty_bit(uint64_t(1) << (index_ % 64)),
+        name(unboundName(index_))
+    {
+    }
+    juce::String getParameterID() const override
+    {
+        return "channel_" + juce::String(index + 1);
+    }
+    float getValue() const override
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+    void setValue(float new_value) override
+    {
+        value.store(std::clamp(new_value, 0.f, 1.f), std::memory_order_relaxed);
+        dirty_word.fetch_or(dirty_bit, std::memory_order_release);
+    }
+    float getDefaultValue() const override
+    {
+        return default_value.load(std::memory_order_relaxed);
+    }
+    juce::String getName(int maximum_length) const override
+    {
+        return name.substring(0, maximum_length);
+    }
+    juce::String getLabel() const override
+    {
+        return {};
+    }
+    juce::String getText(float normalized_value, int maximum_length) const override
+    {
+        return juce::String(toPlain(normalized_value), 4).substring(0, maximum_length);
+    }
+    float getValueForText(const juce::String &text) const override
+    {
+        return toNormalized(text.getDoubleValue());
+    }
+    double toPlain(float normalized_value) const
+    {
+        return minimum + double(normalized_value) * (maximum - minimum);
+    }
+    float toNormalized(double plain_value) const
+    {
+        if (maximum == minimum)
+        {
+            return 0.f;
+        }
+        return float(std::clamp((plain_value - minimum) / (maximum - minimum), 0., 1.));
+    }
+    /**
+     * Binds the parameter to a channel, or unbinds it if channel_pointer_
+     * is null. If the channel is not the one that was bound before, the
+     * parameter takes the channel's default value. Only call this when
+     * Csound is not performing.
+     */
+    void bind(const juce::String &name_, double minimum_, double maximum_, double default_, MYFLT *channel_pointer_, bool audio_)
+    {
+        const bool same_channel = (name_ == name);
+        name = channel_pointer_ != nullptr ? name_ : unboundName(index);
+        minimum = minimum_;
+        maximum = maximum_;
+        channel_pointer = channel_pointer_;
+        audio = audio_;
+        ramp_frames_left = 0;
+        ramp_started = false;
+        default_value.store(toNormalized(default_), std::memory_order_relaxed);
+        if (same_channel == false)
+        {
+            value.store(getDefaultValue(), std::memory_order_relaxed);
+        }
+    }
+    bool isBound() const
+    {
+        return channel_pointer != nullptr;
+    }
+    /**
+     * Returns true if the parameter is bound to a channel like this one.
+     */
+    bool isBoundLike(const ChannelTable::Entry &entry) const
+    {
+        return isBound() == true && name == entry.name && minimum == entry.minimum && maximum == entry.maximum && audio == (entry.type == CSOUND_AUDIO_CHANNEL);
+    }
+    /**
+     * Thread that runs Csound: exchanges the channel pointer for that of
+     * the same channel in another Csound instance. The next write is not
+     * ramped.
+     */
+    void swapChannel(MYFLT *&channel_pointer_)
+    {
+        std::swap(channel_pointer, channel_pointer_);
+        ramp_started = false;
+        ramp_frames_left = 0;
+    }
+    /**
+     * Thread that runs Csound: takes the current value as the target, to
+     * be reached in ramp_frames, or at once if ramp_frames is 0 or the
+     * channel has never been written. Returns true if there is a ramp.
+     */
+    bool startRamp(int ramp_frames)
+    {
+        target = MYFLT(toPlain(getValue()));
+        if (ramp_frames <= 0 || ramp_started == false)
+        {
+            ramp_started = true;
+            current = target;
+            ramp_frames_left = 0;
+            return false;
+        }
+        step = (target - current) / MYFLT(ramp_frames);
+        ramp_frames_left = ramp_frames;
+        return true;
+    }
+    /**
+     * Thread that runs Csound: writes the next ksmps frames of the ramp to
+     * the channel: the value at the end of the block for a control channel,
+     * or every frame for an audio channel. Returns true if the ramp has
+     * not ended.
+     */
+    bool writeRamp(int ksmps)
+    {
+        if (channel_pointer == nullptr)
+        {
+            return false;
+        }
+        if (audio == true)
+        {
+            for (int frame = 0; frame < ksmps; ++frame)
+            {
+                if (ramp_frames_left > 0)
+                {
+                    current = (--ramp_frames_left == 0) ? target : current + step;
+                }
+                channel_pointer[frame] = current;
+            }
+        }
+        else
+        {
+            const int frames = std::min(ksmps, ramp_frames_left);
+            ramp_frames_left -= frames;
+            current = ramp_frames_left == 0 ? target : current + step * MYFLT(frames);
+            *channel_pointer = current;
+        }
+        return ramp_frames_left > 0;
+    }
+private:
+    static juce::String unboundName(int index_)
+    {
+        return "Unused " + juce::String(index_ + 1);
+    }
+    const int index;
+    std::atomic<uint64_t> &dirty_word;
+    const uint64_t dirty_bit;
+    juce::String name;
+    double minimum = 0;
+    double maximum = 1;
+    std::atomic<float> value{0.f};
+    std::atomic<float> default_value{0.f};
+    MYFLT *channel_pointer = nullptr;
+    bool audio = false;
+    // Used only by the thread that runs Csound.
+    bool ramp_started = false;
+    MYFLT current = 0;
+    MYFLT target = 0;
+    MYFLT step = 0;
+    int ramp_frames_left = 0;
+};
+
+/**
+ * A fixed bank of host parameters, created once with the processor since
+ * hosts do not expect parameters to come and go, and bound in prepareToPlay
+ * to the input control and audio channels in the orchestra's channel
+ * table, e.g. those declared with chn_k or chn_a. Unused parameters are
+ * named "Unused n" and do nothing.
+ *
+ * Once per ksmps block, writeChanged pushes only the parameters whose dirty
+ * bits are set, or which are still ramping, so that parameters which are
+ * not being automated cost one relaxed load per 64 of them.
+ */
+class ParameterBank
+{
+public:
+    static constexpr int capacity = 256;
+    /**
+     * Creates the parameters and adds them to the processor, which owns
+     * them. Call once, from the processor's constructor.
+     */
+    void create(juce::AudioProcessor &processor)
+    {
+        for (auto &word : dirty_words)
+        {
+            word.store(0, std::memory_order_relaxed);
+        }
+        for (int index = 0; index < capacity; ++index)
+        {
+            auto parameter = new ChannelParameter(index, dirty_words[size_t(index / 64)]);
+            processor.addParameter(parameter);
+            parameters[size_t(index)] = parameter;
+        }
+    }
+    /**
+     * Binds parameters, in order of channel name, to the orchestra's input
+     * control and audio channels, and unbinds the rest. CsoundVST3's own
+     * channels are skipped. Returns the number of parameters bound. Only
+     * call this when Csound is not performing.
+     */
+    int bind(const ChannelTable &channel_table)
+    {
+        int bound = 0;
+        for (const auto &entry : channel_table.getEntries())
+        {
+            if (isParameterChannel(entry) == false || bound >= capacity)
+            {
+                continue;
+            }
+            auto &parameter = *parameters[size_t(bound)];
+            parameter.bind(entry.name, entry.minimum, entry.maximum, entry.default_value, entry.pointer, entry.type == CSOUND_AUDIO_CHANNEL);
+            for (const auto &restored : restored_values)
+            {
+                if (restored.first == entry.name)
+                {
+                    parameter.setValue(restored.second);
+                }
+            }
+            ++bound;
+        }
+        for (int index = bound; index < capacity; ++index)
+        {
+            parameters[size_t(index)]->bind({}, 0, 1, 0, nullptr, false);
+        }
+        restored_values.clear();
+        for (auto &word : ramping_words)
+        {
+            word = 0;
+        }
+        // The channels start out at the parameters' values, not at the
+        // declared defaults.
+        for (auto &word : dirty_words)
+        {
+            word.store(~uint64_t(0), std::memory_order_release);
+        }
+        return bound;
+    }
+    /**
+     * Restores a value saved with the plugin's state to the parameter that
+     * is bound to the channel of that name, or, if there is none yet, to
+     * the parameter that the next bind binds to it. Parameters are matched
+     * by channel name, not by index, since the saved csd may declare other
+     * channels than the running one. Only call this on the message thread.
+     */
+    void restore(const juce::String &name, float value)
+    {
+        for (auto parameter : parameters)
+        {
+            if (parameter->isBound() == true && parameter->getName(1024) == name)
+            {
+                parameter->setValue(value);
+                return;
+            }
+        }
+        restored_values.emplace_back(name, value);
+    }
+    /**
+     * Looks up, in another orchestra's channel table, the channels that
+     * the parameters are bound to now. Returns false unless that table
+     * would bind exactly the same channels, with the same ranges.
+     */
+    bool findChannels(const ChannelTable &channel_table, std::array<MYFLT *, capacity> &channel_pointers) const
+    {
+        channel_pointers.fill(nullptr);
+        int bound = 0;
+        for (const auto &entry : channel_table.getEntries())
+        {
+            if (isParameterChannel(entry) == false || bound >= capacity)
+            {
+                continue;
+            }
+            if (parameters[size_t(bound)]->isBoundLike(entry) == false)
+            {
+                return false;
+            }
+            channel_pointers[size_t(bound)] = entry.pointer;
+            ++bound;
+        }
+        return bound == capacity || parameters[size_t(bound)]->isBound() == false;
+    }
+    /**
+     * Thread that runs Csound: exchanges the parameters' channel pointers
+     * for those found by findChannels, and writes every parameter to its
+     * new channel at the next ksmps block.
+     */
+    void swapChannels(std::array<MYFLT *, capacity> &channel_pointers)
+    {
+        for (size_t index = 0; index < parameters.size(); ++index)
+        {
+            parameters[index]->swapChannel(channel_pointers[index]);
+        }
+        for (size_t word = 0; word < dirty_words.size(); ++word)
+        {
+            ramping_words[word] = 0;
+            dirty_words[word].store(~uint64_t(0), std::memory_order_release);
+        }
+    }
+    /**
+     * Sets how long, in frames, a parameter takes to ramp to a new value.
+     * Only call this when Csound is not performing.
+     */
+    void setRampFrames(int ramp_frames_)
+    {
+        ramp_frames = std::max(ramp_frames_, 0);
+    }
+    /**
+     * Thread that runs Csound: writes the next ksmps frames of every
+     * parameter that has changed since the last call, or is still ramping,
+     * to its channel.
+     */
+    void writeChanged(int ksmps)
+    {
+        for (size_t word = 0; word < dirty_words.size(); ++word)
+        {
+            auto writing = ramping_words[word];
+            if (dirty_words[word].load(std::memory_order_relaxed) != 0)
+            {
+                auto bits = dirty_words[word].exchange(0, std::memory_order_acquire);
+                writing |= bits;
+                while (bits != 0)
+                {
+                    const auto bit = size_t(std::countr_zero(bits));
+                    bits &= bits - 1;
+                    parameters[word * 64 + bit]->startRamp(ramp_frames);
+                }
+            }
+            ramping_words[word] = 0;
+            while (writing != 0)
+            {
+                const auto bit = size_t(std::countr_zero(writing));
+                writing &= writing - 1;
+                if (parameters[word * 64 + bit]->writeRamp(ksmps) == true)
+                {
+                    ramping_words[word] |= uint64_t(1) << bit;
+                }
+            }
+        }
+    }
+    ChannelParameter &operator[](int index)
+    {
+        return *parameters[size_t(index)];
+    }
+private:
+    static bool isParameterChannel(const ChannelTable::Entry &entry)
+    {
+        return (entry.mode & CSOUND_INPUT_CHANNEL) != 0 && (entry.type == CSOUND_CONTROL_CHANNEL || entry.type == CSOUND_AUDIO_CHANNEL) && entry.name.startsWith("CsoundVST3_") == false;
+    }
+    std::array<ChannelParameter *, capacity> parameters{};
+    std::array<std::atomic<uint64_t>, capacity / 64> dirty_words;
+    // Saved values, by channel name, waiting for the next bind.
+    std::vector<std::pair<juce::String, float>> restored_values;
+    // Used only by the thread that runs Csound.
+    std::array<uint64_t, capacity / 64> ramping_words{};
+    int ramp_frames = 0;
+};
+
+/**
+ * A read-only host parameter that follows one of Csound's output control
+ * channels, so that envelopes, pitch tracks, gain reduction and the like can
+ * be shown in the host or used as modulation sources. The audio thread only
+ * stores the value. As a meter, the parameter is never edited, so the host
+ * is not sent edits; it reads the value when it wants to show it, and the
+ * editor reads the plain value lock-free.
+ */
+class OutputParameter : public juce::HostedAudioProcessorParameter
+{
+public:
+    OutputParameter(int index_) :
+        index(index_),
+        name(unboundName(index_))
+    {
+    }
+    juce::String getParameterID() const override
+    {
+        return "output_" + juce::String(index + 1);
+    }
+    float getValue() const override
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+    void setValue(float) override
+    {
+    }
+    float getDefaultValue() const override
+    {
+        return 0.f;
+    }
+    juce::String getName(int maximum_length) const override
+    {
+        return name.substring(0, maximum_length);
+    }
+    juce::String getLabel() const override
+    {
+        return {};
+    }
+    juce::String getText(float normalized_value, int maximum_length) const override
+    {
+        return juce::String(minimum + double(normalized_value) * (maximum - minimum), 4).substring(0, maximum_length);
+    }
+    float getValueForText(const juce::String &) const override
+    {
+        return getValue();
+    }
+    bool isAutomatable() const override
+    {
+        return false;
+    }
+    Category getCategory() const override
+    {
+        return otherMeter;
+    }
+    /**
+     * Binds the parameter to an output channel, or unbinds it if
+     * channel_pointer_ is null. Only call this when Csound is not
+     * performing.
+     */
+    void bind(const juce::String &name_, double minimum_, double maximum_, const MYFLT *channel_pointer_)
+    {
+        name = channel_pointer_ != nullptr ? name_ : unboundName(index);
+        minimum = minimum_;
+        maximum = maximum_;
+        channel_pointer = channel_pointer_;
+        value.store(0.f, std::memory_order_relaxed);
+        plain_value.store(0.f, std::memory_order_relaxed);
+    }
+    bool isBound() const
+    {
+        return channel_pointer != nullptr;
+    }
+    /**
+     * Returns true if the parameter is bound to a channel like this one.
+     */
+    bool isBoundLike(const ChannelTable::Entry &entry) const
+    {
+        return isBound() == true && name == entry.name && minimum == entry.minimum && maximum == entry.maximum;
+    }
+    /**
+     * Audio thread: exchanges the channel pointer for that of the same
+     * channel in another Csound instance.
+     */
+    void swapChannel(const MYFLT *&channel_pointer_)
+    {
+        std::swap(channel_pointer, channel_pointer_);
+    }
+    /**
+     * Audio thread: reads the channel.
+     */
+    void sample()
+    {
+        if (channel_pointer == nullptr)
+        {
+            return;
+        }
+        const auto plain = double(*channel_pointer);
+        plain_value.store(float(plain), std::memory_order_relaxed);
+        const auto normalized = maximum == minimum ? 0.f : float(std::clamp((plain - minimum) / (maximum - minimum), 0., 1.));
+        value.store(normalized, std::memory_order_relaxed);
+    }
+    /**
+     * Any thread: the channel's value as last sampled, in its own range.
+     */
+    float getPlainValue() const
+    {
+        return plain_value.load(std::memory_order_relaxed);
+    }
+private:
+    static juce::String unboundName(int index_)
+    {
+        return "Unused output " + juce::String(index_ + 1);
+    }
+    const int index;
+    juce::String name;
+    double minimum = 0;
+    double maximum = 1;
+    std::atomic<float> value{0.f};
+    std::atomic<float> plain_value{0.f};
+    const MYFLT *channel_pointer = nullptr;
+};
+
+/**
+ * A fixed bank of read-only host parameters, bound in prepareToPlay to the
+ * control channels in the orchestra's channel table that are for output
+ * only, e.g. declared with chn_k mode 2. sample reads them once per host
+ * block through the table's channel pointers, and the host reads them
+ * from the parameters, as it does any meter.
+ */
+class OutputBank
+{
+public:
+    static constexpr int capacity = 64;
+    /**
+     * Creates the parameters and adds them to the processor, which owns
+     * them. Call once, from the processor's constructor.
+     */
+    void create(juce::AudioProcessor &processor)
+    {
+        for (int index = 0; index < capacity; ++index)
+        {
+            auto parameter = new OutputParameter(index);
+            processor.addParameter(parameter);
+            parameters[size_t(index)] = parameter;
+        }
+    }
+    /**
+     * Binds parameters, in order of channel name, to the orchestra's
+     * output-only control channels, and unbinds the rest. CsoundVST3's own
+     * channels are skipped. Returns the number of parameters bound. Only
+     * call this when Csound is not performing.
+     */
+    int bind(const ChannelTable &channel_table)
+    {
+        int bound = 0;
+        for (const auto &entry : channel_table.getEntries())
+        {
+            if (isOutputChannel(entry) == false || bound >= capacity)
+            {
+                continue;
+            }
+            parameters[size_t(bound)]->bind(entry.name, entry.minimum, entry.maximum, entry.pointer);
+            ++bound;
+        }
+        for (int index = bound; index < capacity; ++index)
+        {
+            parameters[size_t(index)]->bind({}, 0, 1, nullptr);
+        }
+        bound_count.store(bound, std::memory_order_release);
+        return bound;
+    }
+    /**
+     * Looks up, in another orchestra's channel table, the channels that
+     * the parameters are bound to now. Returns false unless that table
+     * would bind exactly the same channels, with the same ranges.
+     */
+    bool findChannels(const ChannelTable &channel_table, std::array<const MYFLT *, capacity> &channel_pointers) const
+    {
+        channel_pointers.fill(nullptr);
+        int bound = 0;
+        for (const auto &entry : channel_table.getEntries())
+        {
+            if (isOutputChannel(entry) == false || bound >= capacity)
+            {
+                continue;
+            }
+            if (parameters[size_t(bound)]->isBoundLike(entry) == false)
+            {
+                return false;
+            }
+            channel_pointers[size_t(bound)] = entry.pointer;
+            ++bound;
+        }
+        return bound == size();
+    }
+    /**
+     * Audio thread: exchanges the parameters' channel pointers for those
+     * found by findChannels.
+     */
+    void swapChannels(std::array<const MYFLT *, capacity> &channel_pointers)
+    {
+        for (size_t index = 0; index < parameters.size(); ++index)
+        {
+            parameters[index]->swapChannel(channel_pointers[index]);
+        }
+    }
+    /**
+     * Audio thread: samples every bound output channel.
+     */
+    void sample()
+    {
+        const int bound = bound_count.load(std::memory_order_relaxed);
+        for (int index = 0; index < bound; ++index)
+        {
+            parameters[size_t(index)]->sample();
+        }
+    }
+    /**
+     * Returns the number of bound parameters, which come first.
+     */
+    int size() const
+    {
+        return bound_count.load(std::memory_order_acquire);
+    }
+    OutputParameter &operator[](int index)
+    {
+        return *parameters[size_t(index)];
+    }
+    const OutputParameter &operator[](int index) const
+    {
+        return *parameters[size_t(index)];
+    }
+private:
+    static bool isOutputChannel(const ChannelTable::Entry &entry)
+    {
+        return entry.type == CSOUND_CONTROL_CHANNEL && entry.mode == CSOUND_OUTPUT_CHANNEL && entry.name.startsWith("CsoundVST3_") == false;
+    }
+    std::array<OutputParameter *, capacity> parameters{};
+    std::atomic<int> bound_count{0};
+};
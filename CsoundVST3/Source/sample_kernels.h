@@ -0,0 +1,606 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CSOUNDVST3_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CSOUNDVST3_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(CSOUNDVST3_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CSOUNDVST3_TARGET_SSE2 __attribute__((target("sse2")))
+#define CSOUNDVST3_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CSOUNDVST3_TARGET_SSE2
+#define CSOUNDVST3_TARGET_AVX2
+#endif
+
+/**
+ * Kernels for moving audio between the host's planar float (or double) channels and
+ * Csound's interleaved double frames ([frame][channel], as in spin and
+ * spout), converting precision and applying the 0dBFS gain in one pass.
+ *
+ * interleave copies host channels [0, planar_channels) at planar_offset into
+ * interleaved frames of interleaved_channels, zeroing interleaved channels
+ * the host does not supply. deinterleave copies interleaved channels
+ * [0, min(interleaved_channels, planar_channels)) out to the host; other
+ * host channels are not touched.
+ *
+ * Mono and stereo, by far the commonest layouts, have vectorized versions;
+ * other channel counts use the scalar loops, which interleave_frames and
+ * deinterleave_frames call directly. The best available kernels are
+ * selected once, at run time, by get_sample_kernels().
+ */
+struct SampleKernels
+{
+    const char *name;
+    void (*interleave)(const float* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain);
+    void (*deinterleave)(const double *interleaved, int interleaved_channels, float* const* planar, int planar_channels, int planar_offset, int frames, double gain);
+    /**
+     * The same, for hosts that process in double precision, where there is
+     * no conversion, only (de)interleaving and gain.
+     */
+    void (*interleave_double)(const double* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain);
+    void (*deinterleave_double)(const double *interleaved, int interleaved_channels, double* const* planar, int planar_channels, int planar_offset, int frames, double gain);
+    /**
+     * Call these rather than the pointers: they send channel counts that
+     * have no vectorized kernels straight to the scalar loops.
+     */
+    void interleave_frames(const float* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain) const;
+    void interleave_frames(const double* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain) const;
+    void deinterleave_frames(const double *interleaved, int interleaved_channels, float* const* planar, int planar_channels, int planar_offset, int frames, double gain) const;
+    void deinterleave_frames(const double *interleaved, int interleaved_channels, double* const* planar, int planar_channels, int planar_offset, int frames, double gain) const;
+};
+
+namespace sample_kernels
+{
+
+template<typename Sample>
+inline void interleave_scalar(const Sample* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain)
+{
+    int channel = 0;
+    for ( ; channel < std::min(planar_channels, interleaved_channels); ++channel)
+    {
+        const Sample *source = planar[channel] + planar_offset;
+        double *destination = interleaved + channel;
+        for (int frame = 0; frame < frames; ++frame, destination += interleaved_channels)
+        {
+            *destination = gain * source[frame];
+        }
+    }
+    for ( ; channel < interleaved_channels; ++channel)
+    {
+        double *destination = interleaved + channel;
+        for (int frame = 0; frame < frames; ++frame, destination += interleaved_channels)
+        {
+            *destination = 0;
+        }
+    }
+}
+
+template<typename Sample>
+inline void deinterleave_scalar(const double *interleaved, int interleaved_channels, Sample* const* planar, int planar_channels, int planar_offset, int frames, double gain)
+{
+    for (int channel = 0; channel < std::min(planar_channels, interleaved_channels); ++channel)
+    {
+        Sample *destination = planar[channel] + planar_offset;
+        const double *source = interleaved + channel;
+        for (int frame = 0; frame < frames; ++frame, source += interleaved_channels)
+        {
+            destination[frame] = Sample(gain * *source);
+        }
+    }
+}
+
+#if defined(CSOUNDVST3_KERNELS_X86)
+
+CSOUNDVST3_TARGET_SSE2 inline void interleave_sse2(const float* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain)
+{
+    const __m128d gains = _mm_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        const float *left = planar[0] + planar_offset;
+        const float *right = planar[1] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            __m128 l = _mm_loadu_ps(left + frame);
+            __m128 r = _mm_loadu_ps(right + frame);
+            __m128d l01 = _mm_mul_pd(_mm_cvtps_pd(l), gains);
+            __m128d l23 = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(l, l)), gains);
+            __m128d r01 = _mm_mul_pd(_mm_cvtps_pd(r), gains);
+            __m128d r23 = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(r, r)), gains);
+            double *destination = interleaved + frame * 2;
+            _mm_storeu_pd(destination + 0, _mm_unpacklo_pd(l01, r01));
+            _mm_storeu_pd(destination + 2, _mm_unpackhi_pd(l01, r01));
+            _mm_storeu_pd(destination + 4, _mm_unpacklo_pd(l23, r23));
+            _mm_storeu_pd(destination + 6, _mm_unpackhi_pd(l23, r23));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        const float *source = planar[0] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            __m128 s = _mm_loadu_ps(source + frame);
+            _mm_storeu_pd(interleaved + frame, _mm_mul_pd(_mm_cvtps_pd(s), gains));
+            _mm_storeu_pd(interleaved + frame + 2, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(s, s)), gains));
+        }
+    }
+    interleave_scalar(planar, planar_channels, planar_offset + frame, interleaved + frame * interleaved_channels, interleaved_channels, frames - frame, gain);
+}
+
+CSOUNDVST3_TARGET_SSE2 inline void deinterleave_sse2(const double *interleaved, int interleaved_channels, float* const* planar, int planar_channels, int planar_offset, int frames, double gain)
+{
+    const __m128d gains = _mm_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        float *left = planar[0] + planar_offset;
+        float *right = planar[1] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            const double *source = interleaved + frame * 2;
+            __m128d f0 = _mm_loadu_pd(source + 0);
+            __m128d f1 = _mm_loadu_pd(source + 2);
+            __m128d f2 = _mm_loadu_pd(source + 4);
+            __m128d f3 = _mm_loadu_pd(source + 6);
+            __m128 l01 = _mm_cvtpd_ps(_mm_mul_pd(_mm_unpacklo_pd(f0, f1), gains));
+            __m128 l23 = _mm_cvtpd_ps(_mm_mul_pd(_mm_unpacklo_pd(f2, f3), gains));
+            __m128 r01 = _mm_cvtpd_ps(_mm_mul_pd(_mm_unpackhi_pd(f0, f1), gains));
+            __m128 r23 = _mm_cvtpd_ps(_mm_mul_pd(_mm_unpackhi_pd(f2, f3), gains));
+            _mm_storeu_ps(left + frame, _mm_movelh_ps(l01, l23));
+            _mm_storeu_ps(right + frame, _mm_movelh_ps(r01, r23));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        float *destination = planar[0] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            __m128 s01 = _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(interleaved + frame), gains));
+            __m128 s23 = _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(interleaved + frame + 2), gains));
+            _mm_storeu_ps(destination + frame, _mm_movelh_ps(s01, s23));
+        }
+    }
+    deinterleave_scalar(interleaved + frame * interleaved_channels, interleaved_channels, planar, planar_channels, planar_offset + frame, frames - frame, gain);
+}
+
+CSOUNDVST3_TARGET_SSE2 inline void interleave_double_sse2(const double* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain)
+{
+    const __m128d gains = _mm_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        const double *left = planar[0] + planar_offset;
+        const double *right = planar[1] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            __m128d l = _mm_mul_pd(_mm_loadu_pd(left + frame), gains);
+            __m128d r = _mm_mul_pd(_mm_loadu_pd(right + frame), gains);
+            _mm_storeu_pd(interleaved + frame * 2, _mm_unpacklo_pd(l, r));
+            _mm_storeu_pd(interleaved + frame * 2 + 2, _mm_unpackhi_pd(l, r));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        const double *source = planar[0] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            _mm_storeu_pd(interleaved + frame, _mm_mul_pd(_mm_loadu_pd(source + frame), gains));
+        }
+    }
+    interleave_scalar(planar, planar_channels, planar_offset + frame, interleaved + frame * interleaved_channels, interleaved_channels, frames - frame, gain);
+}
+
+CSOUNDVST3_TARGET_SSE2 inline void deinterleave_double_sse2(const double *interleaved, int interleaved_channels, double* const* planar, int planar_channels, int planar_offset, int frames, double gain)
+{
+    const __m128d gains = _mm_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        double *left = planar[0] + planar_offset;
+        double *right = planar[1] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            __m128d f0 = _mm_loadu_pd(interleaved + frame * 2);
+            __m128d f1 = _mm_loadu_pd(interleaved + frame * 2 + 2);
+            _mm_storeu_pd(left + frame, _mm_mul_pd(_mm_unpacklo_pd(f0, f1), gains));
+            _mm_storeu_pd(right + frame, _mm_mul_pd(_mm_unpackhi_pd(f0, f1), gains));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        double *destination = planar[0] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            _mm_storeu_pd(destination + frame, _mm_mul_pd(_mm_loadu_pd(interleaved + frame), gains));
+        }
+    }
+    deinterleave_scalar(interleaved + frame * interleaved_channels, interleaved_channels, planar, planar_channels, planar_offset + frame, frames - frame, gain);
+}
+
+CSOUNDVST3_TARGET_AVX2 inline void interleave_avx2(const float* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain)
+{
+    const __m256d gains = _mm256_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        const float *left = planar[0] + planar_offset;
+        const float *right = planar[1] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            // [L0 L1 L2 L3] and [R0 R1 R2 R3]...
+            __m256d l = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(left + frame)), gains);
+            __m256d r = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(right + frame)), gains);
+            // ...to [L0 R0 L2 R2] and [L1 R1 L3 R3]...
+            __m256d low = _mm256_unpacklo_pd(l, r);
+            __m256d high = _mm256_unpackhi_pd(l, r);
+            // ...to [L0 R0 L1 R1] and [L2 R2 L3 R3].
+            double *destination = interleaved + frame * 2;
+            _mm256_storeu_pd(destination + 0, _mm256_permute2f128_pd(low, high, 0x20));
+            _mm256_storeu_pd(destination + 4, _mm256_permute2f128_pd(low, high, 0x31));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        const float *source = planar[0] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            _mm256_storeu_pd(interleaved + frame, _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(source + frame)), gains));
+        }
+    }
+    interleave_scalar(planar, planar_channels, planar_offset + frame, interleaved + frame * interleaved_channels, interleaved_channels, frames - frame, gain);
+}
+
+CSOUNDVST3_TARGET_AVX2 inline void deinterleave_avx2(const double *interleaved, int interleaved_channels, float* const* planar, int planar_channels, int planar_offset, int frames, double gain)
+{
+    const __m256d gains = _mm256_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        float *left = planar[0] + planar_offset;
+        float *right = planar[1] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            // [L0 R0 L1 R1] and [L2 R2 L3 R3]...
+            const double *source = interleaved + frame * 2;
+            __m256d a = _mm256_loadu_pd(source + 0);
+            __m256d b = _mm256_loadu_pd(source + 4);
+            // ...to [L0 L2 L1 L3] and [R0 R2 R1 R3]...
+            __m256d l = _mm256_unpacklo_pd(a, b);
+            __m256d r = _mm256_unpackhi_pd(a, b);
+            // ...to [L0 L1 L2 L3] and [R0 R1 R2 R3].
+            l = _mm256_permute4x64_pd(l, _MM_SHUFFLE(3, 1, 2, 0));
+            r = _mm256_permute4x64_pd(r, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_ps(left + frame, _mm256_cvtpd_ps(_mm256_mul_pd(l, gains)));
+            _mm_storeu_ps(right + frame, _mm256_cvtpd_ps(_mm256_mul_pd(r, gains)));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        float *destination = planar[0] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            _mm_storeu_ps(destination + frame, _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_loadu_pd(interleaved + frame), gains)));
+        }
+    }
+    deinterleave_scalar(interleaved + frame * interleaved_channels, interleaved_channels, planar, planar_channels, planar_offset + frame, frames - frame, gain);
+}
+
+CSOUNDVST3_TARGET_AVX2 inline void interleave_double_avx2(const double* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain)
+{
+    const __m256d gains = _mm256_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        const double *left = planar[0] + planar_offset;
+        const double *right = planar[1] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            __m256d l = _mm256_mul_pd(_mm256_loadu_pd(left + frame), gains);
+            __m256d r = _mm256_mul_pd(_mm256_loadu_pd(right + frame), gains);
+            __m256d low = _mm256_unpacklo_pd(l, r);
+            __m256d high = _mm256_unpackhi_pd(l, r);
+            _mm256_storeu_pd(interleaved + frame * 2, _mm256_permute2f128_pd(low, high, 0x20));
+            _mm256_storeu_pd(interleaved + frame * 2 + 4, _mm256_permute2f128_pd(low, high, 0x31));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        const double *source = planar[0] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            _mm256_storeu_pd(interleaved + frame, _mm256_mul_pd(_mm256_loadu_pd(source + frame), gains));
+        }
+    }
+    interleave_scalar(planar, planar_channels, planar_offset + frame, interleaved + frame * interleaved_channels, interleaved_channels, frames - frame, gain);
+}
+
+CSOUNDVST3_TARGET_AVX2 inline void deinterleave_double_avx2(const double *interleaved, int interleaved_channels, double* const* planar, int planar_channels, int planar_offset, int frames, double gain)
+{
+    const __m256d gains = _mm256_set1_pd(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        double *left = planar[0] + planar_offset;
+        double *right = planar[1] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            __m256d a = _mm256_loadu_pd(interleaved + frame * 2);
+            __m256d b = _mm256_loadu_pd(interleaved + frame * 2 + 4);
+            __m256d l = _mm256_permute4x64_pd(_mm256_unpacklo_pd(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+            __m256d r = _mm256_permute4x64_pd(_mm256_unpackhi_pd(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_pd(left + frame, _mm256_mul_pd(l, gains));
+            _mm256_storeu_pd(right + frame, _mm256_mul_pd(r, gains));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        double *destination = planar[0] + planar_offset;
+        for ( ; frame + 4 <= frames; frame += 4)
+        {
+            _mm256_storeu_pd(destination + frame, _mm256_mul_pd(_mm256_loadu_pd(interleaved + frame), gains));
+        }
+    }
+    deinterleave_scalar(interleaved + frame * interleaved_channels, interleaved_channels, planar, planar_channels, planar_offset + frame, frames - frame, gain);
+}
+
+inline bool cpu_has_avx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+inline bool cpu_has_sse2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif
+
+#if defined(CSOUNDVST3_KERNELS_NEON)
+
+inline void interleave_neon(const float* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain)
+{
+    const float64x2_t gains = vdupq_n_f64(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        const float *left = planar[0] + planar_offset;
+        const float *right = planar[1] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            float64x2x2_t stereo;
+            stereo.val[0] = vmulq_f64(vcvt_f64_f32(vld1_f32(left + frame)), gains);
+            stereo.val[1] = vmulq_f64(vcvt_f64_f32(vld1_f32(right + frame)), gains);
+            vst2q_f64(interleaved + frame * 2, stereo);
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        const float *source = planar[0] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            vst1q_f64(interleaved + frame, vmulq_f64(vcvt_f64_f32(vld1_f32(source + frame)), gains));
+        }
+    }
+    interleave_scalar(planar, planar_channels, planar_offset + frame, interleaved + frame * interleaved_channels, interleaved_channels, frames - frame, gain);
+}
+
+inline void deinterleave_neon(const double *interleaved, int interleaved_channels, float* const* planar, int planar_channels, int planar_offset, int frames, double gain)
+{
+    const float64x2_t gains = vdupq_n_f64(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        float *left = planar[0] + planar_offset;
+        float *right = planar[1] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            float64x2x2_t stereo = vld2q_f64(interleaved + frame * 2);
+            vst1_f32(left + frame, vcvt_f32_f64(vmulq_f64(stereo.val[0], gains)));
+            vst1_f32(right + frame, vcvt_f32_f64(vmulq_f64(stereo.val[1], gains)));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        float *destination = planar[0] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            vst1_f32(destination + frame, vcvt_f32_f64(vmulq_f64(vld1q_f64(interleaved + frame), gains)));
+        }
+    }
+    deinterleave_scalar(interleaved + frame * interleaved_channels, interleaved_channels, planar, planar_channels, planar_offset + frame, frames - frame, gain);
+}
+
+inline void interleave_double_neon(const double* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain)
+{
+    const float64x2_t gains = vdupq_n_f64(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        const double *left = planar[0] + planar_offset;
+        const double *right = planar[1] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            float64x2x2_t stereo;
+            stereo.val[0] = vmulq_f64(vld1q_f64(left + frame), gains);
+            stereo.val[1] = vmulq_f64(vld1q_f64(right + frame), gains);
+            vst2q_f64(interleaved + frame * 2, stereo);
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        const double *source = planar[0] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            vst1q_f64(interleaved + frame, vmulq_f64(vld1q_f64(source + frame), gains));
+        }
+    }
+    interleave_scalar(planar, planar_channels, planar_offset + frame, interleaved + frame * interleaved_channels, interleaved_channels, frames - frame, gain);
+}
+
+inline void deinterleave_double_neon(const double *interleaved, int interleaved_channels, double* const* planar, int planar_channels, int planar_offset, int frames, double gain)
+{
+    const float64x2_t gains = vdupq_n_f64(gain);
+    int frame = 0;
+    if (interleaved_channels == 2 && planar_channels >= 2)
+    {
+        double *left = planar[0] + planar_offset;
+        double *right = planar[1] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            float64x2x2_t stereo = vld2q_f64(interleaved + frame * 2);
+            vst1q_f64(left + frame, vmulq_f64(stereo.val[0], gains));
+            vst1q_f64(right + frame, vmulq_f64(stereo.val[1], gains));
+        }
+    }
+    else if (interleaved_channels == 1 && planar_channels >= 1)
+    {
+        double *destination = planar[0] + planar_offset;
+        for ( ; frame + 2 <= frames; frame += 2)
+        {
+            vst1q_f64(destination + frame, vmulq_f64(vld1q_f64(interleaved + frame), gains));
+        }
+    }
+    deinterleave_scalar(interleaved + frame * interleaved_channels, interleaved_channels, planar, planar_channels, planar_offset + frame, frames - frame, gain);
+}
+
+#endif
+
+inline const SampleKernels &scalar_kernels()
+{
+    static const SampleKernels kernels = {"scalar", interleave_scalar<float>, deinterleave_scalar<float>, interleave_scalar<double>, deinterleave_scalar<double>};
+    return kernels;
+}
+
+/**
+ * Returns every set of kernels that this CPU can run, best last.
+ */
+inline int available_kernels(const SampleKernels **kernels, int capacity)
+{
+    int count = 0;
+    auto add = [&](const SampleKernels &k) { if (count < capacity) { kernels[count++] = &k; } };
+    add(scalar_kernels());
+#if defined(CSOUNDVST3_KERNELS_X86)
+    static const SampleKernels sse2 = {"sse2", interleave_sse2, deinterleave_sse2, interleave_double_sse2, deinterleave_double_sse2};
+    static const SampleKernels avx2 = {"avx2", interleave_avx2, deinterleave_avx2, interleave_double_avx2, deinterleave_double_avx2};
+    if (cpu_has_sse2())
+    {
+        add(sse2);
+    }
+    if (cpu_has_avx2())
+    {
+        add(avx2);
+    }
+#elif defined(CSOUNDVST3_KERNELS_NEON)
+    static const SampleKernels neon = {"neon", interleave_neon, deinterleave_neon, interleave_double_neon, deinterleave_double_neon};
+    add(neon);
+#endif
+    return count;
+}
+
+}
+
+/**
+ * The vectorized kernels only win for mono and stereo; with more channels,
+ * each channel is a strided scalar loop either way, and the benchmark
+ * shows the SIMD builds of it no faster, and sometimes slower.
+ */
+inline bool has_vectorized_kernels(int channels)
+{
+    return channels == 1 || channels == 2;
+}
+
+inline void SampleKernels::interleave_frames(const float* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain) const
+{
+    if (has_vectorized_kernels(interleaved_channels))
+    {
+        interleave(planar, planar_channels, planar_offset, interleaved, interleaved_channels, frames, gain);
+    }
+    else
+    {
+        sample_kernels::interleave_scalar(planar, planar_channels, planar_offset, interleaved, interleaved_channels, frames, gain);
+    }
+}
+
+inline void SampleKernels::interleave_frames(const double* const* planar, int planar_channels, int planar_offset, double *interleaved, int interleaved_channels, int frames, double gain) const
+{
+    if (has_vectorized_kernels(interleaved_channels))
+    {
+        interleave_double(planar, planar_channels, planar_offset, interleaved, interleaved_channels, frames, gain);
+    }
+    else
+    {
+        sample_kernels::interleave_scalar(planar, planar_channels, planar_offset, interleaved, interleaved_channels, frames, gain);
+    }
+}
+
+inline void SampleKernels::deinterleave_frames(const double *interleaved, int interleaved_channels, float* const* planar, int planar_channels, int planar_offset, int frames, double gain) const
+{
+    if (has_vectorized_kernels(interleaved_channels))
+    {
+        deinterleave(interleaved, interleaved_channels, planar, planar_channels, planar_offset, frames, gain);
+    }
+    else
+    {
+        sample_kernels::deinterleave_scalar(interleaved, interleaved_channels, planar, planar_channels, planar_offset, frames, gain);
+    }
+}
+
+inline void SampleKernels::deinterleave_frames(const double *interleaved, int interleaved_channels, double* const* planar, int planar_channels, int planar_offset, int frames, double gain) const
+{
+    if (has_vectorized_kernels(interleaved_channels))
+    {
+        deinterleave_double(interleaved, interleaved_channels, planar, planar_channels, planar_offset, frames, gain);
+    }
+    else
+    {
+        sample_kernels::deinterleave_scalar(interleaved, interleaved_channels, planar, planar_channels, planar_offset, frames, gain);
+    }
+}
+
+/**
+ * Returns the fastest kernels for this CPU, selected on first use.
+ */
+inline const SampleKernels &get_sample_kernels()
+{
+    static const SampleKernels &kernels = []() -> const SampleKernels &
+    {
+        const SampleKernels *available[4];
+        auto count = sample_kernels::available_kernels(available, 4);
+        return *available[count - 1];
+    }();
+    return kernels;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "frame_ring_buffer.h"
+
+#include <cstdint>
+
+/**
+ * A lock-free, single-producer, single-consumer arena for the bytes of MIDI
+ * messages that are too long for a MidiEvent, i.e. System Exclusive
+ * messages. It travels alongside a MIDI FIFO: the producer writes a
+ * message's bytes here and then enqueues its MidiEvent, and the consumer,
+ * taking MidiEvents in the same order, reads or skips the same number of
+ * bytes. So, the bytes of each long message are always the next bytes in
+ * the arena.
+ *
+ * All storage is allocated by resize(), which must only be called when
+ * neither the producer nor the consumer is running.
+ */
+class SysexArena
+{
+public:
+    void resize(int capacity_bytes)
+    {
+        bytes.resize(1, capacity_bytes);
+        bytes_written = 0;
+    }
+    /**
+     * Empties the arena. Not thread-safe.
+     */
+    void clear()
+    {
+        bytes.clear();
+        bytes_written = 0;
+    }
+    int capacity() const
+    {
+        return bytes.capacity();
+    }
+    /**
+     * Producer: returns true if there is room for size bytes.
+     */
+    bool canWrite(int size) const
+    {
+        return size <= bytes.writable();
+    }
+    /**
+     * Producer: writes all of the bytes, or none of them if there is no
+     * room, and returns true if they were written. The offset of the first
+     * byte in the arena is returned, for sanity checks.
+     */
+    bool write(const uint8_t *source, int size, uint32_t &offset)
+    {
+        if (canWrite(size) == false)
+        {
+            return false;
+        }
+        offset = uint32_t(bytes_written % uint64_t(capacity()));
+        bytes.write(source, size);
+        bytes_written += uint64_t(size);
+        return true;
+    }
+    /**
+     * Consumer: copies the next size bytes to the destination, and frees
+     * them. Returns the number of bytes copied.
+     */
+    int read(uint8_t *destination, int size)
+    {
+        return bytes.read(destination, size);
+    }
+    /**
+     * Consumer: frees the next size bytes without reading them.
+     */
+    void skip(int size)
+    {
+        auto spans = bytes.readSpans(size);
+        bytes.commitRead(spans.first.frames + spans.second.frames);
+    }
+private:
+    FrameRingBuffer<uint8_t> bytes;
+    // Producer only.
+    uint64_t bytes_written = 0;
+};
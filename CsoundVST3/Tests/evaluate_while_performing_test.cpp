@@ -0,0 +1,155 @@
+/**
+ * Evaluates instruments into a running Csound while another thread
+ * performs it, as the Evaluate button does: a compile thread compiles one
+ * version of an instrument after another with csoundCompileOrcAsync, an
+ * audio thread performs ksmps blocks, and the main thread, standing in for
+ * the editor's timer, reads the messages of both through MessageQueues,
+ * each thread writing to its own queue.
+ *
+ * Passes if every evaluation compiles, the performance never fails, the
+ * last version evaluated is the one that plays, and every message that the
+ * threads write arrives whole, and in the order that its thread wrote it.
+ *
+ * Usage: evaluate_while_performing_test [evaluations]
+ */
+#include "csound.hpp"
+#include "message_queues.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+static MessageQueues messages(4096);
+static thread_local MessageQueues::Producer producer = MessageQueues::other_thread;
+
+static void message_callback(CSOUND *, int, const char *format, va_list valist)
+{
+    char buffer[0x2000];
+    std::vsnprintf(buffer, sizeof(buffer), format, valist);
+    messages.write(producer, buffer);
+}
+
+static const char *orchestra = R"(
+sr = 48000
+ksmps = 32
+nchnls = 2
+0dbfs = 1
+
+instr 1
+aout oscili 0.1, 440
+outs aout, aout
+endin
+)";
+
+/**
+ * Long enough to be split into several records.
+ */
+static std::string marker(const char *what, int64_t number)
+{
+    return std::string(what) + " " + std::to_string(number) + " " + std::string(300, '.') + "\n";
+}
+
+/**
+ * Returns false unless the text has the markers from 0 through count - 1,
+ * whole and in order.
+ */
+static bool has_markers(const std::string &text, const char *what, int64_t count)
+{
+    size_t position = 0;
+    for (int64_t number = 0; number < count; ++number)
+    {
+        position = text.find(marker(what, number), position);
+        if (position == std::string::npos)
+        {
+            std::printf("Missing, cut short, or out of order: %s %lld\n", what, (long long) number);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const int evaluations = argc > 1 ? std::atoi(argv[1]) : 100;
+    producer = MessageQueues::message_thread;
+    Csound csound;
+    csound.SetMessageCallback(message_callback);
+    csound.SetOption("-n");
+    csound.SetOption("-d");
+    if (csound.CompileOrc(orchestra) != 0 || csound.ReadScore("i 1 0 3600\n") != 0 || csound.Start() != 0)
+    {
+        std::printf("FAILED: Csound did not start.\n");
+        return 1;
+    }
+    std::atomic<bool> evaluating{true};
+    std::atomic<int> compile_failures{0};
+    std::atomic<int> perform_failures{0};
+    std::atomic<int64_t> blocks{0};
+    std::thread audio_thread([&]
+    {
+        producer = MessageQueues::audio_thread;
+        // Goes on for a while after the last evaluation, so that the note
+        // that plays it has time to run.
+        int64_t blocks_after = 0;
+        while (blocks_after < 100)
+        {
+            if (evaluating == false)
+            {
+                ++blocks_after;
+            }
+            if (csound.PerformKsmps() != 0)
+            {
+                ++perform_failures;
+                break;
+            }
+            if (blocks % 16 == 0)
+            {
+                messages.write(producer, marker("block", blocks / 16).c_str());
+            }
+            ++blocks;
+        }
+    });
+    std::thread compile_thread([&]
+    {
+        producer = MessageQueues::compile_thread;
+        for (int version = 0; version < evaluations; ++version)
+        {
+            messages.write(producer, marker("evaluate", version).c_str());
+            const auto instrument = "instr 2\nprints \"instr 2 version " + std::to_string(version) + "\\n\"\nendin\n";
+            if (csoundCompileOrcAsync(csound.GetCsound(), instrument.c_str()) != 0)
+            {
+                ++compile_failures;
+            }
+        }
+        csoundInputMessageAsync(csound.GetCsound(), "i 2 0 0.01\n");
+        evaluating = false;
+    });
+    std::string text;
+    while (evaluating == true || blocks == 0)
+    {
+        messages.read(text);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    compile_thread.join();
+    audio_thread.join();
+    csound.Cleanup();
+    messages.read(text);
+    const auto dropped = messages.takeDropped();
+    const auto last_version = "instr 2 version " + std::to_string(evaluations - 1) + "\n";
+    bool ok = true;
+    ok = has_markers(text, "evaluate", evaluations) && ok;
+    ok = has_markers(text, "block", (blocks + 15) / 16) && ok;
+    if (text.find(last_version) == std::string::npos)
+    {
+        std::printf("The last version evaluated did not play.\n");
+        ok = false;
+    }
+    ok = ok && compile_failures == 0 && perform_failures == 0 && dropped == 0;
+    std::printf("Evaluations: %d, compile failures: %d, blocks: %lld, perform failures: %d, messages dropped: %lld\n", evaluations, compile_failures.load(), (long long) blocks.load(), perform_failures.load(), (long long) dropped);
+    std::printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+/**
+ * Tests OrchestraBlocks, which decides what the Evaluate button compiles
+ * into the running Csound: parses a csd's orchestra into instrument
+ * blocks and global code, and checks what is evaluated when instruments
+ * are unchanged, changed, new, or removed, when the global code changes,
+ * when there is a selection, and after the evaluated blocks have been
+ * merged into the orchestra that is running.
+ *
+ * Passes if every check passes.
+ *
+ * Usage: orchestra_blocks_test
+ */
+#include "orchestra_blocks.h"
+
+#include <cstdio>
+
+static int failures = 0;
+
+static void check(bool condition, const char *what)
+{
+    if (condition == false)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+static juce::String csd(const juce::String &orchestra)
+{
+    return "<CsoundSynthesizer>\n<CsInstruments>\n" + orchestra + "</CsInstruments>\n<CsScore>\n</CsScore>\n</CsoundSynthesizer>\n";
+}
+
+static const char *globals = "sr = 48000\nksmps = 32\nnchnls = 2\n0dbfs = 1\n";
+
+static const char *instr_1 = "instr 1\naout oscili 0.1, 440\nouts aout, aout\nendin\n";
+static const char *instr_2 = "instr 2\naout oscili 0.1, 880\nouts aout, aout\nendin\n";
+static const char *instr_2_edited = "instr 2 ; Now an octave higher.\naout oscili 0.1, 1760\nouts aout, aout\nendin\n";
+static const char *instr_3 = "instr 3\naout vco2 0.1, 220\nouts aout, aout\nendin\n";
+static const char *instr_reverb = "instr Reverb\naleft, aright reverbsc ga_left, ga_right, 0.8, 12000\nouts aleft, aright\nendin\n";
+
+static void test_parse()
+{
+    auto orchestra = OrchestraBlocks::parse(csd(juce::String(globals) + instr_1 + "; instr 9 is only a comment\n" + instr_reverb));
+    check(orchestra.blocks.size() == 2, "parse: two blocks");
+    check(orchestra.find("1") != nullptr && orchestra.find("1")->text == instr_1, "parse: instr 1 is whole");
+    check(orchestra.find("Reverb") != nullptr && orchestra.find("Reverb")->text == instr_reverb, "parse: named instrument");
+    check(orchestra.find("9") == nullptr, "parse: instr in a comment is not a block");
+    check(orchestra.global_code.contains("ksmps = 32"), "parse: global code");
+    auto unterminated = OrchestraBlocks::parse(csd(juce::String(globals) + instr_1 + "instr 4\naout oscili 0.1, 440\n"));
+    check(unterminated.blocks.size() == 1 && unterminated.find("4") == nullptr, "parse: unterminated block is not an instrument");
+    check(unterminated.global_code.contains("instr 4"), "parse: unterminated block is global code");
+    check(OrchestraBlocks::parse("no orchestra").blocks.empty(), "parse: no <CsInstruments>");
+}
+
+static void test_evaluate()
+{
+    auto running = OrchestraBlocks::parse(csd(juce::String(globals) + instr_1 + instr_2 + instr_reverb));
+    // Unchanged.
+    auto unchanged = OrchestraBlocks::parse(csd(juce::String(globals) + instr_1 + instr_2 + instr_reverb)).evaluate(running, {});
+    check(unchanged.code.isEmpty() && unchanged.names.isEmpty(), "evaluate: nothing changed");
+    check(unchanged.global_code_changed == false, "evaluate: global code unchanged");
+    // instr 2 changed, instr 3 new, Reverb removed, instr 1 unchanged.
+    auto edited = OrchestraBlocks::parse(csd(juce::String(globals) + instr_1 + instr_2_edited + instr_3));
+    auto evaluation = edited.evaluate(running, {});
+    check(evaluation.names.size() == 2 && evaluation.names[0] == "2" && evaluation.names[1] == "3", "evaluate: changed and new instruments, in order");
+    check(evaluation.code == juce::String(instr_2_edited) + instr_3, "evaluate: the code is the changed and new blocks");
+    check(evaluation.code.contains("instr 1") == false, "evaluate: unchanged instrument is left out");
+    check(evaluation.code.contains("Reverb") == false, "evaluate: removed instrument is left out");
+    check(evaluation.global_code_changed == false, "evaluate: global code still unchanged");
+    // Once merged, the same edits are not evaluated again, and the removed
+    // instrument stays, as it does in Csound.
+    edited.mergeInto(running);
+    check(running.find("2") != nullptr && running.find("2")->text == instr_2_edited, "merge: changed instrument replaced");
+    check(running.find("3") != nullptr, "merge: new instrument added");
+    check(running.find("Reverb") != nullptr, "merge: removed instrument kept");
+    check(edited.evaluate(running, {}).code.isEmpty(), "evaluate: nothing changed after merge");
+    // Changed global code is reported, and not evaluated.
+    auto global = OrchestraBlocks::parse(csd(juce::String("sr = 48000\nksmps = 64\nnchnls = 2\n0dbfs = 1\ngk_level init 0.5\n") + instr_1 + instr_2_edited + instr_3));
+    auto global_evaluation = global.evaluate(running, {});
+    check(global_evaluation.global_code_changed == true, "evaluate: global code changed");
+    check(global_evaluation.code.isEmpty(), "evaluate: global code is not evaluated");
+}
+
+static void test_selection()
+{
+    auto running = OrchestraBlocks::parse(csd(juce::String(globals) + instr_1 + instr_2));
+    auto edited = OrchestraBlocks::parse(csd(juce::String("gk_level init 0.5\n") + instr_1 + instr_2_edited));
+    const juce::String selection = "instr 1\naout oscili 0.2, 330\nouts aout, aout\nendin\n";
+    auto evaluation = edited.evaluate(running, selection);
+    check(evaluation.code == selection, "selection: the code is the selection");
+    check(evaluation.names.isEmpty(), "selection: no instrument names");
+    check(evaluation.global_code_changed == false, "selection: global code is not compared");
+}
+
+int main()
+{
+    test_parse();
+    test_evaluate();
+    test_selection();
+    std::printf("%s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}